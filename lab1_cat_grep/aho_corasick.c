@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+#include "aho_corasick.h"
+
+// Renumber states so that accepting ones come last and turn state
+// numbers into row offsets, in place: the goto table becomes the
+// transition table, so only one of them is ever allocated.
+// Returns 0, or -1 if memory ran out.
+static int renumber_states(uint32_t *table, const unsigned char *accepting,
+                           size_t state_count, size_t class_count,
+                           uint32_t *start_state, uint32_t *first_accepting) {
+    uint32_t *new_number = (uint32_t *)malloc(state_count * sizeof(uint32_t));
+    unsigned char *placed = (unsigned char *)calloc(state_count, 1);
+    uint32_t *carry = (uint32_t *)malloc(class_count * sizeof(uint32_t));
+    uint32_t next_number = 0;
+
+    if (new_number == NULL || placed == NULL || carry == NULL) {
+        free(new_number);
+        free(placed);
+        free(carry);
+        return -1;
+    }
+
+    for (size_t state = 0; state < state_count; state++) {
+        if (!accepting[state]) new_number[state] = next_number++;
+    }
+    *first_accepting = next_number * (uint32_t)class_count;
+    for (size_t state = 0; state < state_count; state++) {
+        if (accepting[state]) new_number[state] = next_number++;
+    }
+
+    for (size_t i = 0; i < state_count * class_count; i++) {
+        table[i] = new_number[table[i]] * (uint32_t)class_count;
+    }
+
+    // Move every row to its new place, one cycle of the permutation at a
+    // time: the row in hand is swapped with the one at its destination
+    for (size_t first = 0; first < state_count; first++) {
+        if (placed[first]) continue;
+
+        memcpy(carry, table + first * class_count, class_count * sizeof(uint32_t));
+        size_t state = first;
+        do {
+            uint32_t *row = table + (size_t)new_number[state] * class_count;
+            for (size_t byte_class = 0; byte_class < class_count; byte_class++) {
+                uint32_t displaced = row[byte_class];
+                row[byte_class] = carry[byte_class];
+                carry[byte_class] = displaced;
+            }
+            placed[new_number[state]] = 1;
+            state = new_number[state];
+        } while (state != first);
+    }
+
+    *start_state = new_number[0] * (uint32_t)class_count;
+    free(new_number);
+    free(placed);
+    free(carry);
+    return 0;
+}
+
+AhoCorasick *aho_corasick_build(char *const literals[], const size_t lengths[], size_t count) {
+    AhoCorasick *automaton = (AhoCorasick *)calloc(1, sizeof(AhoCorasick));
+    unsigned char used[256] = {0};
+    size_t max_states = 1;
+
+    if (automaton == NULL) return NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < lengths[i]; j++) {
+            used[(unsigned char)literals[i][j]] = 1;
+        }
+        max_states += lengths[i];
+    }
+
+    // Class 0 collects every byte that no literal uses (if there is one)
+    automaton->class_count = (memchr(used, 0, sizeof(used)) != NULL) ? 1 : 0;
+    for (int byte = 0; byte < 256; byte++) {
+        automaton->byte_class[byte] = used[byte] ? (unsigned char)automaton->class_count++ : 0;
+    }
+    size_t class_count = automaton->class_count;
+
+    if (max_states > UINT32_MAX / class_count) {
+        free(automaton);
+        return NULL;
+    }
+
+    // 0 doubles as "no edge" while building: the root is never a child
+    uint32_t *goto_table = (uint32_t *)calloc(max_states * class_count, sizeof(uint32_t));
+    uint32_t *failure = (uint32_t *)calloc(max_states, sizeof(uint32_t));
+    uint32_t *queue = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    unsigned char *accepting = (unsigned char *)calloc(max_states, 1);
+    size_t state_count = 1;
+
+    if (goto_table == NULL || failure == NULL || queue == NULL || accepting == NULL) {
+        free(goto_table);
+        free(failure);
+        free(queue);
+        free(accepting);
+        free(automaton);
+        return NULL;
+    }
+
+    // Trie of all literals
+    for (size_t i = 0; i < count; i++) {
+        size_t state = 0;
+        for (size_t j = 0; j < lengths[i]; j++) {
+            uint32_t *edge = &goto_table[state * class_count + automaton->byte_class[(unsigned char)literals[i][j]]];
+            if (*edge == 0) *edge = (uint32_t)state_count++;
+            state = *edge;
+        }
+        accepting[state] = 1;
+    }
+
+    // Shared prefixes leave rows at the end of the table unused
+    if (state_count < max_states) {
+        uint32_t *shrunk = (uint32_t *)realloc(goto_table, state_count * class_count * sizeof(uint32_t));
+        if (shrunk != NULL) goto_table = shrunk;
+    }
+
+    // Breadth-first: failure links, then missing edges borrowed from the failure state
+    size_t head = 0;
+    size_t tail = 0;
+    for (size_t byte_class = 0; byte_class < class_count; byte_class++) {
+        uint32_t child = goto_table[byte_class];
+        if (child != 0) queue[tail++] = child;
+    }
+
+    while (head < tail) {
+        uint32_t state = queue[head++];
+        uint32_t fallback = failure[state];
+
+        accepting[state] |= accepting[fallback];
+
+        for (size_t byte_class = 0; byte_class < class_count; byte_class++) {
+            uint32_t *edge = &goto_table[state * class_count + byte_class];
+            uint32_t fallback_edge = goto_table[fallback * class_count + byte_class];
+            if (*edge != 0) {
+                failure[*edge] = fallback_edge;
+                queue[tail++] = *edge;
+            } else {
+                *edge = fallback_edge;
+            }
+        }
+    }
+
+    free(failure);
+    free(queue);
+
+    automaton->state_count = state_count;
+    if (renumber_states(goto_table, accepting, state_count, class_count,
+                        &automaton->start_state, &automaton->first_accepting) != 0) {
+        free(goto_table);
+        free(accepting);
+        free(automaton);
+        return NULL;
+    }
+    automaton->transitions = goto_table;
+    free(accepting);
+    return automaton;
+}
+
+const char *aho_corasick_find(const AhoCorasick *automaton, const char *text, size_t length) {
+    const uint32_t *transitions = automaton->transitions;
+    const unsigned char *byte_class = automaton->byte_class;
+    const uint32_t first_accepting = automaton->first_accepting;
+    uint32_t state = automaton->start_state;
+
+    // The empty string is in the set
+    if (state >= first_accepting) return (length > 0) ? text : NULL;
+
+    for (size_t i = 0; i < length; i++) {
+        state = transitions[state + byte_class[(unsigned char)text[i]]];
+        if (state >= first_accepting) return text + i;
+    }
+    return NULL;
+}
+
+void aho_corasick_free(AhoCorasick *automaton) {
+    if (automaton != NULL) {
+        free(automaton->transitions);
+        free(automaton);
+    }
+}
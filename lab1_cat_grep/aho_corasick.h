@@ -0,0 +1,30 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Aho-Corasick automaton over a set of literals, compiled to a full DFA.
+// Bytes are mapped to equivalence classes (one per byte used by the
+// literals plus one for everything else) to keep the table small. States
+// are numbered so that all accepting states come last, and transitions
+// hold premultiplied row offsets: the inner loop is one load and one compare.
+typedef struct {
+    unsigned char byte_class[256];
+    size_t class_count;
+    size_t state_count;
+    uint32_t *transitions;        // row offset of the next state, per (state, class)
+    uint32_t start_state;         // row offset of the root
+    uint32_t first_accepting;     // row offset of the first accepting state
+} AhoCorasick;
+
+// Returns NULL on allocation failure. The literals are not referenced afterwards.
+AhoCorasick *aho_corasick_build(char *const literals[], const size_t lengths[], size_t count);
+
+// Find the first literal occurrence; returns a pointer to its last byte
+// (text itself if the set contains the empty string), or NULL.
+const char *aho_corasick_find(const AhoCorasick *automaton, const char *text, size_t length);
+
+void aho_corasick_free(AhoCorasick *automaton);
+
+#endif
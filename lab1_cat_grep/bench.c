@@ -0,0 +1,285 @@
+#define _GNU_SOURCE  // for wait4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define BENCH_DEFAULT_MB 32
+#define BENCH_DEFAULT_RUNS 3
+#define BENCH_DRAIN_SIZE (256 * 1024)
+#define BENCH_MAX_ARGS 12
+#define SPARSE_MATCH_RATE 5000  // one line in this many holds FATAL
+#define DENSE_MATCH_RATE 4      // one line in this many holds WARN
+
+// Throughput of mycat and mygrep on generated corpora. Every run pipes
+// the program's output back into the harness, like a real pipeline;
+// the fastest of the runs is reported, with the peak RSS of all of them.
+typedef struct {
+    const char *name;
+    int min_words;
+    int max_words;
+} CorpusShape;
+
+typedef struct {
+    char path[PATH_MAX];
+    const char *name;
+    unsigned long long bytes;
+    unsigned long long lines;
+} Corpus;
+
+typedef struct {
+    const char *name;
+    const char *program;
+    const char *args[BENCH_MAX_ARGS];  // options and patterns; the corpus follows
+} BenchCase;
+
+typedef struct {
+    double seconds;
+    long peak_rss_kb;
+    unsigned long long output_bytes;
+    int exit_status;
+} RunResult;
+
+static const CorpusShape corpus_shapes[] = {
+    {"short-lines", 2, 10},
+    {"long-lines", 150, 400},
+};
+
+static const BenchCase bench_cases[] = {
+    {"cat", "./mycat", {NULL}},
+    {"cat-number", "./mycat", {"-n", NULL}},
+    {"cat-ends", "./mycat", {"-E", NULL}},
+    {"literal-sparse", "./mygrep", {"FATAL", NULL}},
+    {"literal-dense", "./mygrep", {"WARN", NULL}},
+    {"literal-dense-number", "./mygrep", {"-n", "WARN", NULL}},
+    {"regex-sparse", "./mygrep", {"FATAL [0-9]+ code=[a-f]+", NULL}},
+    {"regex-dense", "./mygrep", {"W[A-Z]RN|timeout=[0-9]{3}", NULL}},
+    {"multi-pattern", "./mygrep", {"-e", "FATAL", "-e", "panic", "-e", "deadbeef", "-e", "segfault", NULL}},
+    {"fixed-multi-pattern", "./mygrep", {"-F", "-e", "FATAL", "-e", "WARN", "-e", "cache=miss", NULL}},
+    {"count-dense", "./mygrep", {"-c", "WARN", NULL}},
+    {"context-sparse", "./mygrep", {"-C", "2", "FATAL", NULL}},
+    {"parallel-dense", "./mygrep", {"-j", "0", "WARN", NULL}},
+};
+
+static const char *const vocabulary[] = {
+    "request", "user=", "session", "GET", "POST", "/api/v1/items", "status=200", "status=404",
+    "latency", "ms", "cache=hit", "cache=miss", "info", "debug", "worker", "queue", "retry",
+    "timeout=250", "bytes", "client", "upstream", "id", "abc", "x",
+};
+
+static unsigned long long random_state;
+
+// xorshift64*: the corpora are the same on every machine and every run
+static unsigned long long next_random(void) {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 2685821657736338717ULL;
+}
+
+static int generate_corpus(Corpus *corpus, const CorpusShape *shape, const char *directory,
+                           unsigned long long target_bytes) {
+    size_t vocabulary_size = sizeof(vocabulary) / sizeof(vocabulary[0]);
+    FILE *output;
+
+    snprintf(corpus->path, sizeof(corpus->path), "%s/%s.txt", directory, shape->name);
+    corpus->name = shape->name;
+    corpus->bytes = 0;
+    corpus->lines = 0;
+    random_state = 0x9e3779b97f4a7c15ULL;
+
+    output = fopen(corpus->path, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Cannot create '%s': ", corpus->path);
+        perror("");
+        return -1;
+    }
+
+    while (corpus->bytes < target_bytes) {
+        int words = shape->min_words + (int)(next_random() % (unsigned)(shape->max_words - shape->min_words + 1));
+        int length = 0;
+
+        length += fprintf(output, "%llu", 1000000 + corpus->lines);
+        if (next_random() % SPARSE_MATCH_RATE == 0) {
+            length += fprintf(output, " FATAL %llu code=%llx", next_random() % 1000, next_random() % 0xffff);
+        }
+        for (int i = 0; i < words; i++) {
+            length += fprintf(output, " %s", vocabulary[next_random() % vocabulary_size]);
+        }
+        if (next_random() % DENSE_MATCH_RATE == 0) length += fprintf(output, " WARN");
+        fputc('\n', output);
+
+        corpus->bytes += (unsigned long long)length + 1;
+        corpus->lines++;
+    }
+
+    if (fclose(output) != 0) {
+        fprintf(stderr, "Error writing '%s': ", corpus->path);
+        perror("");
+        return -1;
+    }
+    return 0;
+}
+
+static double elapsed_seconds(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run_case(const BenchCase *bench_case, const Corpus *corpus, char *drain, RunResult *result) {
+    const char *argv[BENCH_MAX_ARGS + 2];
+    int argc = 0;
+    int pipe_fds[2];
+    struct timespec start;
+    struct timespec end;
+    struct rusage usage;
+    int status;
+
+    argv[argc++] = bench_case->program;
+    for (int i = 0; bench_case->args[i] != NULL; i++) argv[argc++] = bench_case->args[i];
+    argv[argc++] = corpus->path;
+    argv[argc] = NULL;
+
+    if (pipe(pipe_fds) != 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+    if (child == 0) {
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        execv(argv[0], (char *const *)argv);
+        fprintf(stderr, "Cannot run '%s': ", argv[0]);
+        perror("");
+        _exit(127);
+    }
+
+    close(pipe_fds[1]);
+    result->output_bytes = 0;
+    for (;;) {
+        ssize_t bytes_read = read(pipe_fds[0], drain, BENCH_DRAIN_SIZE);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read <= 0) break;
+        result->output_bytes += (unsigned long long)bytes_read;
+    }
+    close(pipe_fds[0]);
+
+    while (wait4(child, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->seconds = elapsed_seconds(&start, &end);
+    result->peak_rss_kb = usage.ru_maxrss;
+    result->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return 0;
+}
+
+static void print_result(const BenchCase *bench_case, const Corpus *corpus, const RunResult *best, int first) {
+    double megabytes = (double)corpus->bytes / (1024.0 * 1024.0);
+    const char *program = strrchr(bench_case->program, '/');
+
+    printf("%s    {\"program\": \"%s\", \"case\": \"%s\", \"corpus\": \"%s\", ", first ? "" : ",\n",
+           program != NULL ? program + 1 : bench_case->program, bench_case->name, corpus->name);
+    printf("\"bytes\": %llu, \"lines\": %llu, \"seconds\": %.6f, ", corpus->bytes, corpus->lines, best->seconds);
+    printf("\"mb_per_s\": %.1f, \"lines_per_s\": %.0f, \"peak_rss_kb\": %ld, ",
+           megabytes / best->seconds, (double)corpus->lines / best->seconds, best->peak_rss_kb);
+    printf("\"output_bytes\": %llu, \"exit_status\": %d}", best->output_bytes, best->exit_status);
+}
+
+static int bench_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-s MB] [-r RUNS] corpus_directory\n", program);
+    return 1;
+}
+
+int main(int arg_count, char *arg_values[]) {
+    long corpus_mb = BENCH_DEFAULT_MB;
+    long runs = BENCH_DEFAULT_RUNS;
+    size_t shape_count = sizeof(corpus_shapes) / sizeof(corpus_shapes[0]);
+    size_t case_count = sizeof(bench_cases) / sizeof(bench_cases[0]);
+    Corpus corpora[sizeof(corpus_shapes) / sizeof(corpus_shapes[0])];
+    char *number_end;
+    int current_option;
+    int first = 1;
+
+    while ((current_option = getopt(arg_count, arg_values, "s:r:")) != -1) {
+        switch (current_option) {
+            case 's':
+                corpus_mb = strtol(optarg, &number_end, 10);
+                if (*number_end != '\0' || corpus_mb <= 0) return bench_usage(arg_values[0]);
+                break;
+            case 'r':
+                runs = strtol(optarg, &number_end, 10);
+                if (*number_end != '\0' || runs <= 0) return bench_usage(arg_values[0]);
+                break;
+            default:
+                return bench_usage(arg_values[0]);
+        }
+    }
+    if (optind + 1 != arg_count) return bench_usage(arg_values[0]);
+
+    const char *directory = arg_values[optind];
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create '%s': ", directory);
+        perror("");
+        return 1;
+    }
+
+    for (size_t i = 0; i < shape_count; i++) {
+        fprintf(stderr, "Generating %s (%ld MiB)\n", corpus_shapes[i].name, corpus_mb);
+        if (generate_corpus(&corpora[i], &corpus_shapes[i], directory,
+                            (unsigned long long)corpus_mb * 1024 * 1024) != 0) {
+            return 1;
+        }
+    }
+
+    char *drain = (char *)malloc(BENCH_DRAIN_SIZE);
+    if (drain == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("{\n  \"corpus_mb\": %ld,\n  \"runs\": %ld,\n  \"results\": [\n", corpus_mb, runs);
+    for (size_t c = 0; c < shape_count; c++) {
+        for (size_t i = 0; i < case_count; i++) {
+            RunResult best = {0, 0, 0, 0};
+
+            fprintf(stderr, "%s %s\n", bench_cases[i].name, corpora[c].name);
+            for (long run = 0; run < runs; run++) {
+                RunResult result;
+                if (run_case(&bench_cases[i], &corpora[c], drain, &result) != 0) {
+                    free(drain);
+                    return 1;
+                }
+                long peak_rss_kb = (result.peak_rss_kb > best.peak_rss_kb) ? result.peak_rss_kb : best.peak_rss_kb;
+                if (run == 0 || result.seconds < best.seconds) best = result;
+                best.peak_rss_kb = peak_rss_kb;
+            }
+            print_result(&bench_cases[i], &corpora[c], &best, first);
+            first = 0;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    free(drain);
+    return 0;
+}
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE  // for memrchr()
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "block_reader.h"
+
+static _Thread_local sigjmp_buf *fault_jump;
+static pthread_once_t fault_handler_once = PTHREAD_ONCE_INIT;
+
+// Outside a guarded read a SIGBUS is what it always was: the faulting
+// access runs again, now with the default action
+static void handle_mapped_fault(int signal_number) {
+    sigjmp_buf *jump = fault_jump;
+
+    if (jump == NULL) {
+        signal(signal_number, SIG_DFL);
+        return;
+    }
+    fault_jump = NULL;
+    siglongjmp(*jump, 1);
+}
+
+static void install_fault_handler(void) {
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_mapped_fault;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, NULL);
+}
+
+void mapped_read_begin(sigjmp_buf *jump) {
+    pthread_once(&fault_handler_once, install_fault_handler);
+    fault_jump = jump;
+}
+
+void mapped_read_end(void) {
+    fault_jump = NULL;
+}
+
+int block_reader_init(BlockReader *reader, int fd) {
+    struct stat info;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size >= MMAP_THRESHOLD) {
+        reader->mapped = 1;
+        reader->file_size = info.st_size;
+        reader->next_offset = lseek(fd, 0, SEEK_CUR);
+        if (reader->next_offset < 0) reader->next_offset = 0;
+        return 0;
+    }
+
+    reader->capacity = READ_BLOCK_SIZE;
+    reader->buffer = (char *)malloc(reader->capacity);
+    return (reader->buffer != NULL) ? 0 : -1;
+}
+
+void block_reader_init_memory(BlockReader *reader, TextSpan input) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+    reader->from_memory = 1;
+    reader->memory = input;
+}
+
+// A peek cannot be undone on a pipe, so the bytes read to recognize the
+// format stay at the front of the buffer. Reading stops as soon as they
+// cannot be the start of compressed data, so a terminal is not kept waiting.
+static ssize_t read_magic(BlockReader *reader) {
+    size_t length = 0;
+
+    while (length < DECOMPRESS_MAGIC_SIZE) {
+        ssize_t bytes_read = read(reader->fd, reader->buffer + length, DECOMPRESS_MAGIC_SIZE - length);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytes_read == 0) {
+            reader->reached_eof = 1;
+            break;
+        }
+        length += (size_t)bytes_read;
+        if (compressed_format((const unsigned char *)reader->buffer, length) != DECOMPRESS_NONE) break;
+        if (!could_be_compressed((const unsigned char *)reader->buffer, length)) break;
+    }
+    return (ssize_t)length;
+}
+
+int block_reader_init_decompressing(BlockReader *reader, int fd) {
+    unsigned char magic[DECOMPRESS_MAGIC_SIZE];
+    const unsigned char *prefix = NULL;
+    size_t prefix_length = 0;
+    int format;
+
+    if (block_reader_init(reader, fd) != 0) return -1;
+
+    if (reader->mapped) {
+        ssize_t magic_length = pread(fd, magic, sizeof(magic), reader->next_offset);
+        format = (magic_length > 0) ? compressed_format(magic, (size_t)magic_length) : DECOMPRESS_NONE;
+    } else {
+        // A read error here shows up again on the first block_reader_next()
+        ssize_t magic_length = read_magic(reader);
+        if (magic_length <= 0) return 0;
+        reader->filled = (size_t)magic_length;
+        format = compressed_format((const unsigned char *)reader->buffer, reader->filled);
+        prefix = (const unsigned char *)reader->buffer;
+        prefix_length = reader->filled;
+    }
+    if (format == DECOMPRESS_NONE) return 0;
+
+    reader->decompressor = decompressor_start(fd, format, prefix, prefix_length);
+    if (reader->decompressor == NULL) {
+        block_reader_release(reader);
+        return -1;
+    }
+    reader->mapped = 0;
+    reader->filled = 0;
+    return 0;
+}
+
+static void unmap_window(BlockReader *reader) {
+    if (reader->map_base != NULL) {
+        munmap(reader->map_base, reader->map_length);
+        reader->map_base = NULL;
+        reader->map_length = 0;
+    }
+}
+
+// Map the window starting at the next unread line. Windows end on a line
+// boundary, so a line longer than the window makes the window grow.
+static int next_mapped_block(BlockReader *reader, TextSpan *block) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t window = MMAP_WINDOW_SIZE;
+
+    unmap_window(reader);
+
+    if (reader->next_offset >= reader->file_size) return 0;
+
+    // mmap offsets must be page aligned; skip the bytes before the line start
+    off_t map_offset = reader->next_offset & ~((off_t)page_size - 1);
+    size_t skip = (size_t)(reader->next_offset - map_offset);
+
+    for (;;) {
+        size_t remaining = (size_t)(reader->file_size - map_offset);
+        size_t map_length = (remaining < window) ? remaining : window;
+
+        reader->map_base = mmap(NULL, map_length, PROT_READ, MAP_PRIVATE, reader->fd, map_offset);
+        if (reader->map_base == MAP_FAILED) {
+            reader->map_base = NULL;
+            return -1;
+        }
+        reader->map_length = map_length;
+        madvise(reader->map_base, map_length, MADV_SEQUENTIAL);
+
+        size_t block_end = map_length;
+        if (map_length < remaining) {
+            const char *last_newline = memrchr(reader->map_base + skip, '\n', map_length - skip);
+            if (last_newline == NULL) {
+                unmap_window(reader);
+                window *= 2;
+                continue;
+            }
+            block_end = (size_t)(last_newline - reader->map_base) + 1;
+        }
+
+        reader->next_offset = map_offset + (off_t)block_end;
+        block->data = reader->map_base + skip;
+        block->length = block_end - skip;
+        return 1;
+    }
+}
+
+int block_reader_next(BlockReader *reader, TextSpan *block) {
+    if (reader->decompressor != NULL) {
+        return decompressor_next(reader->decompressor, block);
+    }
+    if (reader->from_memory) {
+        if (reader->reached_eof || reader->memory.length == 0) return 0;
+        reader->reached_eof = 1;
+        *block = reader->memory;
+        return 1;
+    }
+    if (reader->mapped) {
+        return next_mapped_block(reader, block);
+    }
+
+    // Move the partial line left over from the previous block to the front
+    if (reader->consumed > 0) {
+        memmove(reader->buffer, reader->buffer + reader->consumed,
+                reader->filled - reader->consumed);
+        reader->filled -= reader->consumed;
+        reader->consumed = 0;
+    }
+
+    while (!reader->reached_eof) {
+        // A single line longer than the buffer: grow until it fits
+        if (reader->filled == reader->capacity) {
+            char *grown = (char *)realloc(reader->buffer, reader->capacity * 2);
+            if (grown == NULL) return -1;
+            reader->buffer = grown;
+            reader->capacity *= 2;
+        }
+
+        ssize_t bytes_read = read(reader->fd, reader->buffer + reader->filled,
+                                  reader->capacity - reader->filled);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytes_read == 0) {
+            reader->reached_eof = 1;
+            break;
+        }
+
+        // Only the freshly read bytes can contain the last newline
+        const char *last_newline = memrchr(reader->buffer + reader->filled, '\n', bytes_read);
+        reader->filled += bytes_read;
+
+        if (last_newline != NULL) {
+            reader->consumed = (size_t)(last_newline - reader->buffer) + 1;
+            block->data = reader->buffer;
+            block->length = reader->consumed;
+            return 1;
+        }
+    }
+
+    if (reader->filled == 0) return 0;
+
+    reader->consumed = reader->filled;
+    block->data = reader->buffer;
+    block->length = reader->filled;
+    return 1;
+}
+
+void block_reader_release(BlockReader *reader) {
+    if (reader->decompressor != NULL) {
+        decompressor_stop(reader->decompressor);
+        reader->decompressor = NULL;
+    }
+    unmap_window(reader);
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
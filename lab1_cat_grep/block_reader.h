@@ -0,0 +1,66 @@
+#ifndef BLOCK_READER_H
+#define BLOCK_READER_H
+
+#include <stddef.h>
+#include <setjmp.h>
+#include <sys/types.h>
+#include "text_span.h"
+#include "decompressor.h"
+
+#define READ_BLOCK_SIZE (1024 * 1024)
+#define MMAP_THRESHOLD (256 * 1024)
+#define MMAP_WINDOW_SIZE ((size_t)256 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t capacity;
+    size_t filled;      // bytes currently held in buffer
+    size_t consumed;    // bytes handed out by the previous block_reader_next()
+    int reached_eof;
+
+    // Mapped mode: regular files are searched in place, window by window
+    int mapped;
+    char *map_base;
+    size_t map_length;
+    off_t file_size;
+    off_t next_offset;  // file offset of the first byte not handed out yet
+
+    // Compressed input is decoded by a reader thread instead
+    Decompressor *decompressor;
+
+    // Memory mode: the whole input was read elsewhere and is one block
+    int from_memory;
+    TextSpan memory;
+} BlockReader;
+
+// Regular files of at least MMAP_THRESHOLD bytes are mapped instead of read;
+// pipes, terminals and small files use the read() path.
+int block_reader_init(BlockReader *reader, int fd);
+
+// Hand out input that is already in memory, without a descriptor.
+void block_reader_init_memory(BlockReader *reader, TextSpan input);
+
+// Like block_reader_init(), but input starting with the magic bytes of a
+// supported compression format is handed out decompressed.
+int block_reader_init_decompressing(BlockReader *reader, int fd);
+
+// Hand out the next run of complete lines read from the descriptor.
+// Lines never straddle two blocks; only the final block may lack a
+// trailing newline. The block stays valid until the next call.
+// Returns 1 when a block is available, 0 at end of input, -1 on read error.
+int block_reader_next(BlockReader *reader, TextSpan *block);
+
+void block_reader_release(BlockReader *reader);
+
+// A mapped file that shrinks while it is read (copytruncate log rotation)
+// raises SIGBUS on the pages past its new end. Code that touches mapped
+// input calls sigsetjmp(jump, 1), then mapped_read_begin(&jump), and
+// mapped_read_end() when done: a fault in between returns from that
+// sigsetjmp() with 1, and the input is taken to end there. The jump
+// target is per thread.
+void mapped_read_begin(sigjmp_buf *jump);
+
+void mapped_read_end(void);
+
+#endif
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE  // for memrchr()
+#include <stdlib.h>
+#include <string.h>
+#include "context_lines.h"
+
+static const char *line_end_from(const char *from, const char *end) {
+    const char *newline = memchr(from, '\n', end - from);
+    return (newline != NULL) ? newline + 1 : end;
+}
+
+// Start of the line that ends right before at (at > floor)
+static const char *line_start_before(const char *floor, const char *at) {
+    const char *newline = memrchr(floor, '\n', (at - 1) - floor);
+    return (newline != NULL) ? newline + 1 : floor;
+}
+
+static void print_line_span(ContextPrinter *printer, const char *start, const char *end,
+                            unsigned long long line_number) {
+    TextSpan line = {start, (size_t)(end - start)};
+    print_context_line(&printer->search, line, line_number);
+}
+
+// Once a line of the block is printed, nothing before it is context any more
+static void mark_printed(ContextPrinter *printer, const char *printed_end, unsigned long long line_number) {
+    printer->unprinted_from = printed_end;
+    printer->last_number = line_number;
+    printer->ring_count = 0;
+    printer->dropped = 0;
+}
+
+static void print_after_context(ContextPrinter *printer, const char *limit) {
+    while (printer->after_remaining > 0 && printer->unprinted_from < limit) {
+        const char *line_end = line_end_from(printer->unprinted_from, limit);
+        print_line_span(printer, printer->unprinted_from, line_end, printer->last_number + 1);
+        mark_printed(printer, line_end, printer->last_number + 1);
+        printer->after_remaining--;
+    }
+}
+
+static void print_match_with_context(void *handler_arg, TextSpan line, unsigned long long line_number) {
+    ContextPrinter *printer = (ContextPrinter *)handler_arg;
+    size_t wanted = (size_t)printer->search.before_context;
+    const char *first = line.data;
+    size_t block_lines = 0;
+    size_t ring_lines = 0;
+
+    print_after_context(printer, line.data);
+
+    while (block_lines < wanted && first > printer->unprinted_from) {
+        first = line_start_before(printer->unprinted_from, first);
+        block_lines++;
+    }
+    // The ring only holds lines while nothing of this block is printed
+    if (first == printer->block_start) {
+        ring_lines = wanted - block_lines;
+        if (ring_lines > printer->ring_count) ring_lines = printer->ring_count;
+    }
+
+    // The first group of an input is apart from whatever came before it
+    int gap = !printer->printed_any || (first > printer->unprinted_from) ||
+              printer->ring_count > ring_lines || printer->dropped;
+    if (gap) print_context_separator(&printer->search);
+
+    unsigned long long number = line_number - block_lines - ring_lines;
+    for (size_t i = printer->ring_count - ring_lines; i < printer->ring_count; i++) {
+        print_context_line(&printer->search, printer->ring[i], number++);
+    }
+    while (first < line.data) {
+        const char *line_end = line_end_from(first, line.data);
+        print_line_span(printer, first, line_end, number++);
+        first = line_end;
+    }
+    print_search_line(&printer->search, line, line_number);
+
+    mark_printed(printer, span_end(line), line_number);
+    printer->printed_any = 1;
+    printer->after_remaining = (unsigned long long)printer->search.after_context;
+}
+
+static int reserve_carry(ContextPrinter *printer, int index, size_t size) {
+    if (printer->carry_capacity[index] >= size) return 0;
+
+    char *grown = (char *)realloc(printer->carry[index], size);
+    if (grown == NULL) return -1;
+    printer->carry[index] = grown;
+    printer->carry_capacity[index] = size;
+    return 0;
+}
+
+// The block is about to be replaced: keep copies of its last unprinted
+// lines (topped up from the ring when the block printed nothing at all)
+static void finish_block(ContextPrinter *printer, TextSpan block) {
+    size_t wanted = (size_t)printer->search.before_context;
+    const char *block_end = span_end(block);
+    const char *first = block_end;
+    size_t block_lines = 0;
+    size_t ring_lines = 0;
+
+    print_after_context(printer, block_end);
+
+    while (block_lines < wanted && first > printer->unprinted_from) {
+        first = line_start_before(printer->unprinted_from, first);
+        block_lines++;
+    }
+    if (first == block.data) {
+        ring_lines = wanted - block_lines;
+        if (ring_lines > printer->ring_count) ring_lines = printer->ring_count;
+    }
+    int dropped = (first > printer->unprinted_from) ||
+                  (first == block.data && (printer->ring_count > ring_lines || printer->dropped));
+
+    size_t size = (size_t)(block_end - first);
+    for (size_t i = printer->ring_count - ring_lines; i < printer->ring_count; i++) {
+        size += printer->ring[i].length;
+    }
+
+    int target = 1 - printer->carry_current;
+    if (reserve_carry(printer, target, size) != 0) {
+        // Without memory the context before the next block is lost
+        printer->ring_count = 0;
+        printer->dropped = 1;
+        return;
+    }
+
+    char *copy = printer->carry[target];
+    size_t kept = 0;
+    for (size_t i = printer->ring_count - ring_lines; i < printer->ring_count; i++) {
+        memcpy(copy, printer->ring[i].data, printer->ring[i].length);
+        printer->ring[kept].data = copy;
+        printer->ring[kept].length = printer->ring[i].length;
+        copy += printer->ring[i].length;
+        kept++;
+    }
+    while (first < block_end) {
+        const char *line_end = line_end_from(first, block_end);
+        memcpy(copy, first, line_end - first);
+        printer->ring[kept].data = copy;
+        printer->ring[kept].length = (size_t)(line_end - first);
+        copy += line_end - first;
+        first = line_end;
+        kept++;
+    }
+
+    printer->ring_count = kept;
+    printer->dropped = dropped;
+    printer->carry_current = target;
+}
+
+int context_printer_init(ContextPrinter *printer, const SearchContext *context) {
+    memset(printer, 0, sizeof(*printer));
+    printer->search = *context;
+    printer->search.match_handler = print_match_with_context;
+    printer->search.handler_arg = printer;
+
+    if (context->before_context > 0) {
+        printer->ring = (TextSpan *)malloc((size_t)context->before_context * sizeof(TextSpan));
+        if (printer->ring == NULL) return -1;
+    }
+    return 0;
+}
+
+int context_search_block(ContextPrinter *printer, TextSpan block, unsigned long long *line_number) {
+    printer->block_start = block.data;
+    printer->unprinted_from = block.data;
+
+    int found_status = search_block_pattern(&printer->search, block, line_number);
+    finish_block(printer, block);
+    return found_status;
+}
+
+void context_printer_restart(ContextPrinter *printer) {
+    printer->ring_count = 0;
+    printer->dropped = 1;
+    printer->after_remaining = 0;
+}
+
+void context_printer_release(ContextPrinter *printer) {
+    free(printer->ring);
+    free(printer->carry[0]);
+    free(printer->carry[1]);
+}
@@ -0,0 +1,43 @@
+#ifndef CONTEXT_LINES_H
+#define CONTEXT_LINES_H
+
+#include "search_engine.h"
+
+#define MAX_CONTEXT_LINES 100000
+
+// Prints -A/-B/-C context around the matches of one input, block by block.
+// Context is only looked for when a line matches: before-context lines are
+// found by scanning back from the match, after-context lines by scanning
+// forward, so non-matching stretches cost nothing extra. When a block is
+// done, its last before_context unprinted lines are copied into a ring of
+// line spans, for a match at the start of the next block. Non-adjacent
+// groups are separated by "--" lines; groups of different inputs are not.
+typedef struct {
+    SearchContext search;       // the input's context, its matches routed here
+    TextSpan *ring;             // before_context slots, oldest line first
+    size_t ring_count;
+    char *carry[2];             // storage of the ring's lines; one is filled from the other
+    size_t carry_capacity[2];
+    int carry_current;
+    int dropped;                // unprinted lines precede the ring's
+    const char *block_start;
+    const char *unprinted_from; // first line of the block neither printed nor skipped
+    int printed_any;
+    unsigned long long after_remaining;
+    unsigned long long last_number; // number of the last line printed
+} ContextPrinter;
+
+// Returns 0, or -1 if the ring could not be allocated.
+int context_printer_init(ContextPrinter *printer, const SearchContext *context);
+
+// Like search_block_pattern(), printing the context of every match.
+// Blocks must follow each other in the input.
+int context_search_block(ContextPrinter *printer, TextSpan block, unsigned long long *line_number);
+
+// The input starts over (a followed file was truncated or replaced):
+// nothing printed or kept so far is next to what comes now.
+void context_printer_restart(ContextPrinter *printer);
+
+void context_printer_release(ContextPrinter *printer);
+
+#endif
@@ -0,0 +1,424 @@
+#define _GNU_SOURCE  // for memrchr()
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "decompressor.h"
+
+#ifdef HAVE_ZLIB
+static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+#endif
+#ifdef HAVE_ZSTD
+static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+#endif
+
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t length;          // complete lines, except in the last slot
+} RingSlot;
+
+struct Decompressor {
+    int fd;
+    int format;
+
+    // Compressed input, owned by the reader thread
+    unsigned char *input;
+    size_t input_length;
+    size_t input_pos;
+    int input_eof;
+    int in_frame;           // inside a gzip member or zstd frame
+#ifdef HAVE_ZLIB
+    z_stream gzip;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+
+    // The partial line at the end of the last filled slot, which starts the next one
+    char *carry;
+    size_t carry_length;
+    size_t carry_capacity;
+
+    // Slot i % DECOMPRESS_RING_SLOTS is filled by the reader thread while
+    // produced <= i < consumed + DECOMPRESS_RING_SLOTS, and belongs to the
+    // consumer while consumed <= i < produced
+    RingSlot slots[DECOMPRESS_RING_SLOTS];
+    size_t produced;
+    size_t consumed;
+    int holding;            // the consumer still uses slot consumed
+    int finished;           // nothing will be produced any more
+    int error;              // errno of the failure that finished the thread
+    int stopping;           // the consumer is done, possibly early
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+int compressed_format(const unsigned char *magic, size_t length) {
+#ifdef HAVE_ZLIB
+    if (length >= sizeof(gzip_magic) && memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0) {
+        return DECOMPRESS_GZIP;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (length >= sizeof(zstd_magic) && memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0) {
+        return DECOMPRESS_ZSTD;
+    }
+#endif
+    (void)magic;
+    (void)length;
+    return DECOMPRESS_NONE;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+static int is_magic_prefix(const unsigned char *start, size_t length,
+                           const unsigned char *magic, size_t magic_length) {
+    return length < magic_length && memcmp(start, magic, length) == 0;
+}
+
+#endif
+
+int could_be_compressed(const unsigned char *start, size_t length) {
+    int possible = 0;
+
+#ifdef HAVE_ZLIB
+    possible |= is_magic_prefix(start, length, gzip_magic, sizeof(gzip_magic));
+#endif
+#ifdef HAVE_ZSTD
+    possible |= is_magic_prefix(start, length, zstd_magic, sizeof(zstd_magic));
+#endif
+    (void)start;
+    (void)length;
+    return possible;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+// Read more compressed bytes once the previous ones are used up
+static int refill_input(Decompressor *decompressor) {
+    if (decompressor->input_pos < decompressor->input_length || decompressor->input_eof) return 0;
+
+    for (;;) {
+        ssize_t bytes_read = read(decompressor->fd, decompressor->input, DECOMPRESS_INPUT_SIZE);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        decompressor->input_pos = 0;
+        decompressor->input_length = (size_t)bytes_read;
+        decompressor->input_eof = (bytes_read == 0);
+        return 0;
+    }
+}
+
+static int input_exhausted(const Decompressor *decompressor) {
+    return decompressor->input_eof && decompressor->input_pos == decompressor->input_length;
+}
+#endif
+
+// Each decoder writes at least one byte to out and returns the count,
+// returns 0 at the end of the data, or -1 with errno set
+
+#ifdef HAVE_ZLIB
+// Concatenated members are decoded one after the other; like gzip itself,
+// anything after the last member that is not another one is ignored
+static ssize_t decode_gzip(Decompressor *decompressor, char *out, size_t capacity) {
+    z_stream *stream = &decompressor->gzip;
+
+    stream->next_out = (Bytef *)out;
+    stream->avail_out = (uInt)((capacity < UINT_MAX) ? capacity : UINT_MAX);
+    size_t available = stream->avail_out;
+
+    for (;;) {
+        if (refill_input(decompressor) != 0) return -1;
+        int at_end = input_exhausted(decompressor);
+
+        if (!decompressor->in_frame) {
+            if (at_end || decompressor->input[decompressor->input_pos] != gzip_magic[0]) return 0;
+            inflateReset(stream);
+            decompressor->in_frame = 1;
+        }
+
+        stream->next_in = decompressor->input + decompressor->input_pos;
+        stream->avail_in = (uInt)(decompressor->input_length - decompressor->input_pos);
+        int result = inflate(stream, Z_NO_FLUSH);
+        decompressor->input_pos = decompressor->input_length - stream->avail_in;
+
+        if (result == Z_STREAM_END) {
+            decompressor->in_frame = 0;
+        } else if (result == Z_MEM_ERROR) {
+            errno = ENOMEM;
+            return -1;
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        size_t written = available - stream->avail_out;
+        if (written > 0) return (ssize_t)written;
+        if (at_end && decompressor->in_frame) {
+            errno = EBADMSG;  // truncated
+            return -1;
+        }
+    }
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static ssize_t decode_zstd(Decompressor *decompressor, char *out, size_t capacity) {
+    ZSTD_outBuffer output = {out, capacity, 0};
+
+    for (;;) {
+        if (refill_input(decompressor) != 0) return -1;
+        int at_end = input_exhausted(decompressor);
+
+        ZSTD_inBuffer input = {decompressor->input, decompressor->input_length, decompressor->input_pos};
+        size_t result = ZSTD_decompressStream(decompressor->zstd, &output, &input);
+        decompressor->input_pos = input.pos;
+
+        if (ZSTD_isError(result)) {
+            errno = EBADMSG;
+            return -1;
+        }
+        decompressor->in_frame = (result != 0);
+
+        if (output.pos > 0) return (ssize_t)output.pos;
+        if (at_end) {
+            if (!decompressor->in_frame) return 0;
+            errno = EBADMSG;  // truncated
+            return -1;
+        }
+    }
+}
+#endif
+
+static ssize_t decode_some(Decompressor *decompressor, char *out, size_t capacity) {
+#ifdef HAVE_ZLIB
+    if (decompressor->format == DECOMPRESS_GZIP) return decode_gzip(decompressor, out, capacity);
+#endif
+#ifdef HAVE_ZSTD
+    if (decompressor->format == DECOMPRESS_ZSTD) return decode_zstd(decompressor, out, capacity);
+#endif
+    (void)decompressor;
+    (void)out;
+    (void)capacity;
+    errno = EINVAL;
+    return -1;
+}
+
+static int grow_slot(RingSlot *slot, size_t needed) {
+    size_t capacity = slot->capacity;
+
+    while (capacity < needed) capacity *= 2;
+    if (capacity == slot->capacity) return 0;
+
+    char *grown = (char *)realloc(slot->data, capacity);
+    if (grown == NULL) return -1;
+    slot->data = grown;
+    slot->capacity = capacity;
+    return 0;
+}
+
+static int keep_carry(Decompressor *decompressor, const char *tail, size_t length) {
+    if (length > decompressor->carry_capacity) {
+        char *grown = (char *)realloc(decompressor->carry, length);
+        if (grown == NULL) return -1;
+        decompressor->carry = grown;
+        decompressor->carry_capacity = length;
+    }
+    memcpy(decompressor->carry, tail, length);
+    decompressor->carry_length = length;
+    return 0;
+}
+
+// Decode until the slot is full, then cut it after its last newline and
+// carry the rest over. A line longer than the slot makes the slot grow.
+// Returns 1 for a full slot, 0 for the last one (possibly empty), -1 on
+// error; on a decoding error the slot still holds the complete lines
+// decoded before it.
+static int fill_slot(Decompressor *decompressor, RingSlot *slot) {
+    size_t filled = decompressor->carry_length;
+
+    slot->length = 0;
+    if (grow_slot(slot, filled + 1) != 0) return -1;
+    if (filled > 0) memcpy(slot->data, decompressor->carry, filled);
+    decompressor->carry_length = 0;
+
+    for (;;) {
+        if (filled == slot->capacity && grow_slot(slot, filled + 1) != 0) return -1;
+
+        ssize_t decoded = decode_some(decompressor, slot->data + filled, slot->capacity - filled);
+        if (decoded < 0) {
+            const char *last_newline = (filled > 0) ? memrchr(slot->data, '\n', filled) : NULL;
+            if (last_newline != NULL) slot->length = (size_t)(last_newline - slot->data) + 1;
+            return -1;
+        }
+        if (decoded == 0) {
+            slot->length = filled;
+            return 0;
+        }
+        filled += (size_t)decoded;
+        if (filled < slot->capacity) continue;
+
+        const char *last_newline = memrchr(slot->data, '\n', filled);
+        if (last_newline != NULL) {
+            slot->length = (size_t)(last_newline - slot->data) + 1;
+            if (keep_carry(decompressor, slot->data + slot->length, filled - slot->length) != 0) return -1;
+            return 1;
+        }
+    }
+}
+
+static void *decompress_thread(void *arg) {
+    Decompressor *decompressor = (Decompressor *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&decompressor->lock);
+        while (decompressor->produced - decompressor->consumed == DECOMPRESS_RING_SLOTS &&
+               !decompressor->stopping) {
+            pthread_cond_wait(&decompressor->changed, &decompressor->lock);
+        }
+        int stopping = decompressor->stopping;
+        RingSlot *slot = &decompressor->slots[decompressor->produced % DECOMPRESS_RING_SLOTS];
+        pthread_mutex_unlock(&decompressor->lock);
+
+        if (stopping) break;
+
+        int fill_status = fill_slot(decompressor, slot);
+        int fill_error = errno;
+
+        pthread_mutex_lock(&decompressor->lock);
+        // Lines decoded before an error are handed out ahead of the error
+        if (slot->length > 0) decompressor->produced++;
+        if (fill_status <= 0) {
+            decompressor->finished = 1;
+            if (fill_status < 0) decompressor->error = (fill_error != 0) ? fill_error : EIO;
+        }
+        pthread_cond_broadcast(&decompressor->changed);
+        pthread_mutex_unlock(&decompressor->lock);
+
+        if (fill_status <= 0) break;
+    }
+    return NULL;
+}
+
+static void free_decompressor(Decompressor *decompressor) {
+#ifdef HAVE_ZLIB
+    if (decompressor->format == DECOMPRESS_GZIP) inflateEnd(&decompressor->gzip);
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_freeDStream(decompressor->zstd);
+#endif
+    for (size_t i = 0; i < DECOMPRESS_RING_SLOTS; i++) {
+        free(decompressor->slots[i].data);
+    }
+    free(decompressor->carry);
+    free(decompressor->input);
+    free(decompressor);
+}
+
+static int init_decoder(Decompressor *decompressor) {
+#ifdef HAVE_ZLIB
+    if (decompressor->format == DECOMPRESS_GZIP) {
+        // 16 + MAX_WBITS: gzip wrapper only
+        if (inflateInit2(&decompressor->gzip, 16 + MAX_WBITS) != Z_OK) return -1;
+        return 0;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (decompressor->format == DECOMPRESS_ZSTD) {
+        decompressor->zstd = ZSTD_createDStream();
+        return (decompressor->zstd != NULL) ? 0 : -1;
+    }
+#endif
+    (void)decompressor;
+    return -1;
+}
+
+Decompressor *decompressor_start(int fd, int format, const unsigned char *prefix, size_t prefix_length) {
+    Decompressor *decompressor = (Decompressor *)calloc(1, sizeof(Decompressor));
+    int failed;
+
+    if (decompressor == NULL) return NULL;
+    decompressor->fd = fd;
+    decompressor->format = format;
+    decompressor->input = (unsigned char *)malloc(DECOMPRESS_INPUT_SIZE);
+    failed = (decompressor->input == NULL || prefix_length > DECOMPRESS_INPUT_SIZE);
+
+    for (size_t i = 0; i < DECOMPRESS_RING_SLOTS && !failed; i++) {
+        decompressor->slots[i].data = (char *)malloc(DECOMPRESS_SLOT_SIZE);
+        decompressor->slots[i].capacity = DECOMPRESS_SLOT_SIZE;
+        failed = (decompressor->slots[i].data == NULL);
+    }
+    if (failed || init_decoder(decompressor) != 0) {
+        decompressor->format = DECOMPRESS_NONE;  // nothing to tear down
+        free_decompressor(decompressor);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (prefix_length > 0) memcpy(decompressor->input, prefix, prefix_length);
+    decompressor->input_length = prefix_length;
+
+    pthread_mutex_init(&decompressor->lock, NULL);
+    pthread_cond_init(&decompressor->changed, NULL);
+    if (pthread_create(&decompressor->thread, NULL, decompress_thread, decompressor) != 0) {
+        pthread_cond_destroy(&decompressor->changed);
+        pthread_mutex_destroy(&decompressor->lock);
+        free_decompressor(decompressor);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return decompressor;
+}
+
+int decompressor_next(Decompressor *decompressor, TextSpan *block) {
+    int status;
+
+    pthread_mutex_lock(&decompressor->lock);
+    if (decompressor->holding) {
+        decompressor->consumed++;
+        decompressor->holding = 0;
+        pthread_cond_broadcast(&decompressor->changed);
+    }
+    while (decompressor->produced == decompressor->consumed && !decompressor->finished) {
+        pthread_cond_wait(&decompressor->changed, &decompressor->lock);
+    }
+
+    if (decompressor->produced > decompressor->consumed) {
+        const RingSlot *slot = &decompressor->slots[decompressor->consumed % DECOMPRESS_RING_SLOTS];
+        block->data = slot->data;
+        block->length = slot->length;
+        decompressor->holding = 1;
+        status = 1;
+    } else if (decompressor->error != 0) {
+        errno = decompressor->error;
+        status = -1;
+    } else {
+        status = 0;
+    }
+    pthread_mutex_unlock(&decompressor->lock);
+    return status;
+}
+
+// A reader thread blocked in read() on a pipe only notices the stop once
+// that read returns
+void decompressor_stop(Decompressor *decompressor) {
+    pthread_mutex_lock(&decompressor->lock);
+    decompressor->stopping = 1;
+    pthread_cond_broadcast(&decompressor->changed);
+    pthread_mutex_unlock(&decompressor->lock);
+
+    pthread_join(decompressor->thread, NULL);
+    pthread_cond_destroy(&decompressor->changed);
+    pthread_mutex_destroy(&decompressor->lock);
+    free_decompressor(decompressor);
+}
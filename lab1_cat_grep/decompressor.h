@@ -0,0 +1,43 @@
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+
+#include <stddef.h>
+#include "text_span.h"
+
+// Formats are only recognized when the build found their library
+// (HAVE_ZLIB, HAVE_ZSTD); other compressed input is searched as is.
+#define DECOMPRESS_NONE 0
+#define DECOMPRESS_GZIP 1
+#define DECOMPRESS_ZSTD 2
+
+#define DECOMPRESS_MAGIC_SIZE 4
+#define DECOMPRESS_RING_SLOTS 4
+#define DECOMPRESS_SLOT_SIZE (1024 * 1024)
+#define DECOMPRESS_INPUT_SIZE (256 * 1024)
+
+// Decodes a compressed descriptor on its own thread into a ring of
+// DECOMPRESS_RING_SLOTS buffers, each ending on a line boundary, so that
+// decompression of the next blocks overlaps with searching the current one.
+typedef struct Decompressor Decompressor;
+
+// The supported format starting with the given bytes, or DECOMPRESS_NONE.
+// magic may be shorter than DECOMPRESS_MAGIC_SIZE.
+int compressed_format(const unsigned char *magic, size_t length);
+
+// 1 if more bytes could still turn start into a supported magic number.
+int could_be_compressed(const unsigned char *start, size_t length);
+
+// Start decoding fd from its current offset. prefix holds bytes already
+// read from fd (to sniff the format) that come before that offset.
+// Returns NULL with errno set on failure.
+Decompressor *decompressor_start(int fd, int format, const unsigned char *prefix, size_t prefix_length);
+
+// Like block_reader_next(): hand out the next run of complete lines, valid
+// until the next call. Returns 1, 0 at the end of the data, or -1 with
+// errno set (EBADMSG for corrupt or truncated data).
+int decompressor_next(Decompressor *decompressor, TextSpan *block);
+
+// Stop the reader thread, possibly before the end of the data, and free.
+void decompressor_stop(Decompressor *decompressor);
+
+#endif
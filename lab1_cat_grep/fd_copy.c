@@ -0,0 +1,83 @@
+#define _GNU_SOURCE  // for copy_file_range(), splice()
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "fd_copy.h"
+
+typedef ssize_t (*KernelCopy)(int input_fd, int output_fd, size_t length);
+
+static ssize_t copy_with_copy_file_range(int input_fd, int output_fd, size_t length) {
+    return copy_file_range(input_fd, NULL, output_fd, NULL, length, 0);
+}
+
+static ssize_t copy_with_sendfile(int input_fd, int output_fd, size_t length) {
+    return sendfile(output_fd, input_fd, NULL, length);
+}
+
+static ssize_t copy_with_splice(int input_fd, int output_fd, size_t length) {
+    return splice(input_fd, NULL, output_fd, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+// Returns 1 at end of input, 0 if the method gave up (unsupported
+// descriptors, O_APPEND output, ...); the offsets show how far it got
+static int kernel_copy(KernelCopy method, int input_fd, int output_fd) {
+    for (;;) {
+        ssize_t copied = method(input_fd, output_fd, KERNEL_COPY_CHUNK);
+        if (copied > 0) continue;
+        if (copied == 0) return 1;
+        if (errno != EINTR) return 0;
+    }
+}
+
+static int buffered_copy(int input_fd, int output_fd) {
+    char *buffer = (char *)malloc(COPY_BUFFER_SIZE);
+    int status = 0;
+
+    if (buffer == NULL) return -1;
+
+    while (status == 0) {
+        ssize_t bytes_read = read(input_fd, buffer, COPY_BUFFER_SIZE);
+        if (bytes_read == 0) break;
+        if (bytes_read < 0) {
+            if (errno != EINTR) status = -1;
+            continue;
+        }
+
+        ssize_t written = 0;
+        while (written < bytes_read && status == 0) {
+            ssize_t result = write(output_fd, buffer + written, bytes_read - written);
+            if (result >= 0) {
+                written += result;
+            } else if (errno != EINTR) {
+                status = -1;
+            }
+        }
+    }
+
+    free(buffer);
+    return status;
+}
+
+int copy_descriptor(int input_fd, int output_fd) {
+    struct stat input_info;
+    struct stat output_info;
+    int finished = 0;
+
+    if (fstat(input_fd, &input_info) == 0 && fstat(output_fd, &output_info) == 0) {
+        if (S_ISREG(input_info.st_mode) && S_ISREG(output_info.st_mode)) {
+            finished = kernel_copy(copy_with_copy_file_range, input_fd, output_fd);
+        }
+        if (!finished && S_ISREG(input_info.st_mode)) {
+            finished = kernel_copy(copy_with_sendfile, input_fd, output_fd);
+        } else if (!finished && (S_ISFIFO(input_info.st_mode) || S_ISFIFO(output_info.st_mode))) {
+            finished = kernel_copy(copy_with_splice, input_fd, output_fd);
+        }
+    }
+
+    // Also runs after a kernel method saw the end: files like those in
+    // procfs report size 0 to it, and a final read() confirms the end
+    return buffered_copy(input_fd, output_fd);
+}
@@ -0,0 +1,15 @@
+#ifndef FD_COPY_H
+#define FD_COPY_H
+
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define KERNEL_COPY_CHUNK ((size_t)1 << 30)
+
+// Copy everything left in input_fd to output_fd, starting and advancing at
+// both descriptors' current offsets. Data stays in the kernel where the
+// descriptor types allow it: copy_file_range between regular files,
+// sendfile from a regular file, splice to or from a pipe. Whatever a
+// kernel method cannot handle is finished by a read()/write() loop.
+// Returns 0 on success, -1 with errno set.
+int copy_descriptor(int input_fd, int output_fd);
+
+#endif
@@ -0,0 +1,326 @@
+#define _GNU_SOURCE  // for syscall()
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "file_batch.h"
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// One slot more than the queue depth: the file handed out last keeps its
+// buffer while BATCH_QUEUE_DEPTH others are in flight
+#define BATCH_SLOTS (BATCH_QUEUE_DEPTH + 1)
+
+#define SLOT_OPENING 0
+#define SLOT_READING 1
+#define SLOT_READY 2
+
+#define OP_OPEN 0
+#define OP_READ 1
+
+typedef struct {
+    int state;
+    int fd;
+    size_t length;
+    int read_failed;
+    int unread;         // not a regular file: fd is handed out as opened
+} BatchSlot;
+
+struct FileBatch {
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;    // 0 when the completion ring shares sq_ring
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail; // includes entries prepared but not submitted
+    unsigned to_submit;
+    unsigned in_flight;     // operations prepared and not completed yet
+    int broken;             // io_uring_enter() failed; the rest is opened by the caller
+
+    char *const *paths;
+    int count;
+    int next_open;          // first file not queued for opening yet
+    int next_deliver;       // first file not handed out yet
+    int delivered_fd;       // descriptor of the file handed out last
+    char *buffers;          // BATCH_READ_SIZE bytes per slot
+    BatchSlot slots[BATCH_SLOTS];
+};
+
+static void teardown_ring(FileBatch *batch) {
+    if (batch->sqes != NULL) munmap(batch->sqes, batch->sqes_size);
+    if (batch->cq_ring != NULL && batch->cq_ring_size > 0) munmap(batch->cq_ring, batch->cq_ring_size);
+    if (batch->sq_ring != NULL) munmap(batch->sq_ring, batch->sq_ring_size);
+    if (batch->ring_fd >= 0) close(batch->ring_fd);
+}
+
+static void *map_ring(int ring_fd, size_t size, off_t offset) {
+    void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+    return (ring != MAP_FAILED) ? ring : NULL;
+}
+
+static int setup_ring(FileBatch *batch) {
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    batch->ring_fd = (int)syscall(__NR_io_uring_setup, 2 * BATCH_QUEUE_DEPTH, &params);
+    if (batch->ring_fd < 0) return -1;
+
+    batch->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    batch->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (batch->cq_ring_size > batch->sq_ring_size) batch->sq_ring_size = batch->cq_ring_size;
+        batch->cq_ring_size = 0;
+    }
+
+    batch->sq_ring = map_ring(batch->ring_fd, batch->sq_ring_size, IORING_OFF_SQ_RING);
+    if (batch->sq_ring == NULL) return -1;
+    batch->cq_ring = (batch->cq_ring_size > 0)
+                     ? map_ring(batch->ring_fd, batch->cq_ring_size, IORING_OFF_CQ_RING)
+                     : batch->sq_ring;
+    if (batch->cq_ring == NULL) return -1;
+    batch->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    batch->sqes = (struct io_uring_sqe *)map_ring(batch->ring_fd, batch->sqes_size, IORING_OFF_SQES);
+    if (batch->sqes == NULL) return -1;
+
+    char *sq = (char *)batch->sq_ring;
+    char *cq = (char *)batch->cq_ring;
+    batch->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    batch->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    batch->sq_array = (unsigned *)(sq + params.sq_off.array);
+    batch->cq_head = (unsigned *)(cq + params.cq_off.head);
+    batch->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    batch->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    batch->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    batch->sq_local_tail = *batch->sq_tail;
+    return 0;
+}
+
+static BatchSlot *slot_of(FileBatch *batch, int file_index) {
+    return &batch->slots[file_index % BATCH_SLOTS];
+}
+
+static char *buffer_of(FileBatch *batch, int file_index) {
+    return batch->buffers + (size_t)(file_index % BATCH_SLOTS) * BATCH_READ_SIZE;
+}
+
+// At most 2 * BATCH_QUEUE_DEPTH entries are ever prepared between two
+// submissions (an open and a read per file in flight), so the
+// submission queue cannot overflow
+static struct io_uring_sqe *prepare_sqe(FileBatch *batch, int file_index, int operation) {
+    unsigned index = batch->sq_local_tail & *batch->sq_mask;
+    struct io_uring_sqe *sqe = &batch->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((__u64)file_index << 1) | (__u64)operation;
+    batch->sq_array[index] = index;
+    batch->sq_local_tail++;
+    batch->to_submit++;
+    batch->in_flight++;
+    return sqe;
+}
+
+static void queue_open(FileBatch *batch, int file_index) {
+    struct io_uring_sqe *sqe = prepare_sqe(batch, file_index, OP_OPEN);
+    BatchSlot *slot = slot_of(batch, file_index);
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (__u64)(unsigned long)batch->paths[file_index];
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+    slot->state = SLOT_OPENING;
+    slot->fd = -1;
+    slot->length = 0;
+    slot->read_failed = 0;
+    slot->unread = 0;
+}
+
+static void queue_read(FileBatch *batch, int file_index, int fd) {
+    struct io_uring_sqe *sqe = prepare_sqe(batch, file_index, OP_READ);
+
+    // Only regular files get here: reading at offset 0 leaves the file
+    // offset alone, so a file larger than the buffer can still be read
+    // from the start by the caller, and a short read means end of file
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (__u64)(unsigned long)buffer_of(batch, file_index);
+    sqe->len = BATCH_READ_SIZE;
+    sqe->off = 0;
+}
+
+static int submit_and_wait(FileBatch *batch, unsigned wait_for) {
+    __atomic_store_n(batch->sq_tail, batch->sq_local_tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        long submitted = syscall(__NR_io_uring_enter, batch->ring_fd, batch->to_submit, wait_for,
+                                 wait_for ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted >= 0) {
+            batch->to_submit -= (unsigned)submitted;
+            return 0;
+        }
+        if (errno != EINTR) return -1;
+    }
+}
+
+// A failed open leaves the slot without a descriptor: the caller opens the
+// file again and reports the error the usual way. Pipes, FIFOs and
+// terminals are handed back unread; a read of theirs would consume data
+// and could come back short long before the end.
+static void handle_completion(FileBatch *batch, __u64 user_data, int result) {
+    int file_index = (int)(user_data >> 1);
+    BatchSlot *slot = slot_of(batch, file_index);
+
+    batch->in_flight--;
+    if ((user_data & 1) == OP_OPEN) {
+        if (result < 0) {
+            slot->state = SLOT_READY;
+            return;
+        }
+        struct stat file_stat;
+        slot->fd = result;
+        if (fstat(result, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            slot->unread = 1;
+            slot->state = SLOT_READY;
+            return;
+        }
+        slot->state = SLOT_READING;
+        queue_read(batch, file_index, result);
+        return;
+    }
+
+    slot->read_failed = (result < 0);
+    slot->length = (result > 0) ? (size_t)result : 0;
+    slot->state = SLOT_READY;
+}
+
+static void reap_completions(FileBatch *batch) {
+    unsigned head = *batch->cq_head;
+    unsigned tail = __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &batch->cqes[head & *batch->cq_mask];
+        handle_completion(batch, cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(batch->cq_head, head, __ATOMIC_RELEASE);
+}
+
+FileBatch *file_batch_open(char *const paths[], int count) {
+    FileBatch *batch = (FileBatch *)calloc(1, sizeof(FileBatch));
+
+    if (batch == NULL) return NULL;
+    batch->ring_fd = -1;
+    batch->delivered_fd = -1;
+    batch->paths = paths;
+    batch->count = count;
+    batch->buffers = (char *)malloc((size_t)BATCH_SLOTS * BATCH_READ_SIZE);
+
+    if (batch->buffers == NULL || setup_ring(batch) != 0) {
+        teardown_ring(batch);
+        free(batch->buffers);
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+int file_batch_next(FileBatch *batch, BatchFile *file) {
+    if (batch->delivered_fd >= 0) {
+        close(batch->delivered_fd);
+        batch->delivered_fd = -1;
+    }
+    if (batch->next_deliver >= batch->count) return 0;
+
+    while (batch->next_open < batch->count && batch->next_open - batch->next_deliver < BATCH_QUEUE_DEPTH) {
+        queue_open(batch, batch->next_open++);
+    }
+
+    BatchSlot *slot = slot_of(batch, batch->next_deliver);
+    while (slot->state != SLOT_READY && !batch->broken) {
+        if (submit_and_wait(batch, 1) != 0) {
+            batch->broken = 1;
+            break;
+        }
+        reap_completions(batch);
+    }
+    // Reads queued by the completions just reaped start right away
+    if (batch->to_submit > 0 && !batch->broken && submit_and_wait(batch, 0) != 0) batch->broken = 1;
+
+    file->path = batch->paths[batch->next_deliver];
+    file->complete = 0;
+    file->data.data = NULL;
+    file->data.length = 0;
+    file->fd = -1;
+    if (slot->state == SLOT_READY) {
+        file->fd = slot->fd;
+        file->complete = (slot->fd >= 0 && !slot->unread && !slot->read_failed &&
+                          slot->length < BATCH_READ_SIZE);
+        if (file->complete) {
+            file->data.data = buffer_of(batch, batch->next_deliver);
+            file->data.length = slot->length;
+        }
+        batch->delivered_fd = slot->fd;
+    }
+
+    batch->next_deliver++;
+    return 1;
+}
+
+void file_batch_close(FileBatch *batch) {
+    if (batch->delivered_fd >= 0) close(batch->delivered_fd);
+
+    // The kernel may still write into the buffers until everything in
+    // flight has completed
+    while (batch->in_flight > 0 && !batch->broken) {
+        if (submit_and_wait(batch, 1) != 0) {
+            batch->broken = 1;
+            break;
+        }
+        reap_completions(batch);
+    }
+
+    for (int i = batch->next_deliver; i < batch->next_open; i++) {
+        BatchSlot *slot = slot_of(batch, i);
+        if (slot->fd >= 0) close(slot->fd);
+    }
+
+    teardown_ring(batch);
+    // After a failed io_uring_enter() requests may still be pending, so the
+    // buffers are left alone rather than handed back to malloc
+    if (!batch->broken) free(batch->buffers);
+    free(batch);
+}
+
+#else
+
+FileBatch *file_batch_open(char *const paths[], int count) {
+    (void)paths;
+    (void)count;
+    return NULL;
+}
+
+int file_batch_next(FileBatch *batch, BatchFile *file) {
+    (void)batch;
+    (void)file;
+    return 0;
+}
+
+void file_batch_close(FileBatch *batch) {
+    (void)batch;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef FILE_BATCH_H
+#define FILE_BATCH_H
+
+#include "text_span.h"
+
+#define BATCH_MIN_FILES 8      // fewer files are not worth setting up a ring
+#define BATCH_QUEUE_DEPTH 64
+#define BATCH_READ_SIZE (64 * 1024)
+
+// Opens and reads many small files ahead of their consumer through
+// io_uring: up to BATCH_QUEUE_DEPTH files are in flight at once, each
+// opened and then, if it is a regular file, read (the first
+// BATCH_READ_SIZE bytes) without a blocking system call per step. Built only with HAVE_IO_URING; without
+// it, or when the kernel refuses io_uring, file_batch_open() returns NULL
+// and callers open the files themselves.
+typedef struct FileBatch FileBatch;
+
+typedef struct {
+    const char *path;
+    int complete;       // data holds the whole file
+    TextSpan data;
+    int fd;             // open and unread when the file is larger or not a regular file,
+                        // -1 if opening failed
+} BatchFile;
+
+// paths must stay valid until file_batch_close().
+FileBatch *file_batch_open(char *const paths[], int count);
+
+// Hand out the files in the order of paths. The previous file's data and
+// descriptor are released by this call. When neither complete nor fd is
+// set the caller should open path itself, which also reports the error.
+// Returns 1, or 0 after the last file.
+int file_batch_next(FileBatch *batch, BatchFile *file);
+
+void file_batch_close(FileBatch *batch);
+
+#endif
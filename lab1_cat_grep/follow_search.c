@@ -0,0 +1,281 @@
+#define _GNU_SOURCE  // for memrchr()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "follow_search.h"
+#include "literal_search.h"
+#include "context_lines.h"
+
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIRECTORY_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+typedef struct {
+    const char *path;
+    const char *name;       // last path component, as directory events report it
+    int fd;                 // -1 while the file is missing
+    int watch;              // on the file itself, -1 while it is missing
+    int directory_watch;    // on its directory, to see the name come back
+    dev_t device;
+    ino_t inode;
+    char *pending;          // bytes read after the last complete line
+    size_t pending_length;
+    size_t pending_capacity;
+    unsigned long long line_number;
+    ContextPrinter printer;     // with -A/-B/-C only
+    int with_context;
+} FollowedFile;
+
+typedef struct {
+    const SearchContext *context;
+    int notify_fd;
+    int found;
+} FollowState;
+
+// With -n numbering continues from the lines already in the file
+static unsigned long long count_existing_lines(int fd) {
+    char *buffer = (char *)malloc(FOLLOW_READ_SIZE);
+    unsigned long long lines = 0;
+    off_t offset = 0;
+    ssize_t bytes_read;
+
+    if (buffer == NULL) return 0;
+    while ((bytes_read = pread(fd, buffer, FOLLOW_READ_SIZE, offset)) > 0) {
+        lines += count_newlines(buffer, (size_t)bytes_read);
+        offset += bytes_read;
+    }
+    free(buffer);
+    return lines;
+}
+
+// Start following whatever is at file->path now, from its end (at_end) or
+// from its start (a file that appeared after the search began)
+static int open_followed_file(FollowState *state, FollowedFile *file, int at_end) {
+    struct stat info;
+
+    file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (file->fd == -1) return -1;
+
+    file->watch = inotify_add_watch(state->notify_fd, file->path, FILE_EVENTS);
+    if (file->watch == -1 || fstat(file->fd, &info) != 0) {
+        close(file->fd);
+        file->fd = -1;
+        return -1;
+    }
+    file->device = info.st_dev;
+    file->inode = info.st_ino;
+    file->pending_length = 0;
+    file->line_number = 1;
+    if (file->with_context) context_printer_restart(&file->printer);
+
+    if (at_end) {
+        if (state->context->line_numbers) file->line_number += count_existing_lines(file->fd);
+        lseek(file->fd, 0, SEEK_END);
+    }
+    return 0;
+}
+
+static void close_followed_file(FollowState *state, FollowedFile *file) {
+    if (file->watch != -1) inotify_rm_watch(state->notify_fd, file->watch);
+    if (file->fd != -1) close(file->fd);
+    file->watch = -1;
+    file->fd = -1;
+}
+
+static void search_complete_lines(FollowState *state, FollowedFile *file, size_t fresh_length) {
+    SearchContext context = *state->context;
+    const char *fresh = file->pending + file->pending_length;
+    const char *last_newline = memrchr(fresh, '\n', fresh_length);
+
+    file->pending_length += fresh_length;
+    if (last_newline == NULL) return;
+
+    TextSpan lines = {file->pending, (size_t)(last_newline - file->pending) + 1};
+    context.source_name = file->path;
+
+    if (context.report_mode == REPORT_QUIET) {
+        state->found |= (count_block_matches(&context, lines, 1) > 0);
+    } else if (file->with_context) {
+        state->found |= context_search_block(&file->printer, lines, &file->line_number);
+    } else {
+        state->found |= search_block_pattern(&context, lines, &file->line_number);
+    }
+
+    file->pending_length -= lines.length;
+    memmove(file->pending, file->pending + lines.length, file->pending_length);
+}
+
+// Search everything appended since the last call. A partial last line
+// waits in pending until its newline arrives.
+static void read_appended(FollowState *state, FollowedFile *file) {
+    for (;;) {
+        if (file->pending_capacity - file->pending_length < FOLLOW_READ_SIZE) {
+            size_t capacity = file->pending_capacity ? file->pending_capacity * 2 : FOLLOW_READ_SIZE * 2;
+            char *grown = (char *)realloc(file->pending, capacity);
+            if (grown == NULL) {
+                perror("realloc");
+                return;
+            }
+            file->pending = grown;
+            file->pending_capacity = capacity;
+        }
+
+        ssize_t bytes_read = read(file->fd, file->pending + file->pending_length,
+                                  file->pending_capacity - file->pending_length);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Read error on '%s': ", file->path);
+            perror("");
+            return;
+        }
+        if (bytes_read == 0) return;
+
+        search_complete_lines(state, file, (size_t)bytes_read);
+    }
+}
+
+static void check_truncated(FollowedFile *file) {
+    struct stat info;
+    off_t position = lseek(file->fd, 0, SEEK_CUR);
+
+    if (fstat(file->fd, &info) == 0 && position > info.st_size) {
+        fprintf(stderr, "'%s' was truncated, searching it from the start\n", file->path);
+        lseek(file->fd, 0, SEEK_SET);
+        file->pending_length = 0;
+        file->line_number = 1;
+        if (file->with_context) context_printer_restart(&file->printer);
+    }
+}
+
+// The name now refers to another file (or none): finish the old one and
+// switch to the new one, if it is there yet. A file that was only moved
+// away keeps being read until its replacement appears, since the writer
+// usually goes on appending to it for a moment.
+static void follow_replacement(FollowState *state, FollowedFile *file) {
+    struct stat info;
+
+    if (file->fd != -1) {
+        int name_found = (stat(file->path, &info) == 0);
+        if (name_found && info.st_dev == file->device && info.st_ino == file->inode) return;
+
+        read_appended(state, file);
+        if (!name_found && fstat(file->fd, &info) == 0 && info.st_nlink > 0) return;
+        close_followed_file(state, file);
+    }
+    open_followed_file(state, file, 0);
+    if (file->fd != -1) read_appended(state, file);
+}
+
+static void handle_event(FollowState *state, FollowedFile *files, int file_count,
+                         const struct inotify_event *event) {
+    for (int i = 0; i < file_count; i++) {
+        FollowedFile *file = &files[i];
+
+        if (event->wd == file->watch && file->fd != -1) {
+            if (event->mask & IN_IGNORED) {
+                file->watch = -1;  // the kernel already dropped it
+            } else if (event->mask & IN_MODIFY) {
+                check_truncated(file);
+                read_appended(state, file);
+            } else if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB)) {
+                // IN_ATTRIB also reports an unlink, which we see as a
+                // changed name -> inode mapping
+                follow_replacement(state, file);
+            }
+        }
+
+        if (event->wd == file->directory_watch) {
+            if (event->mask & IN_IGNORED) {
+                file->directory_watch = -1;
+            } else if (event->len > 0 && strcmp(event->name, file->name) == 0) {
+                follow_replacement(state, file);
+            }
+        }
+    }
+}
+
+static int directory_watch_for(FollowState *state, const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *directory;
+    int watch;
+
+    if (slash == NULL) return inotify_add_watch(state->notify_fd, ".", DIRECTORY_EVENTS);
+
+    directory = strndup(path, (slash == path) ? 1 : (size_t)(slash - path));
+    if (directory == NULL) return -1;
+    watch = inotify_add_watch(state->notify_fd, directory, DIRECTORY_EVENTS);
+    free(directory);
+    return watch;
+}
+
+static int anything_followed(const FollowedFile *files, int file_count) {
+    for (int i = 0; i < file_count; i++) {
+        if (files[i].fd != -1 || files[i].directory_watch != -1) return 1;
+    }
+    return 0;
+}
+
+int follow_files_pattern(const SearchContext *context, char *const files[], int file_count) {
+    FollowState state = {context, inotify_init1(IN_CLOEXEC), 0};
+    FollowedFile *followed = (FollowedFile *)calloc(file_count, sizeof(FollowedFile));
+    char *events = (char *)malloc(FOLLOW_EVENT_BUFFER_SIZE);
+
+    if (state.notify_fd == -1 || followed == NULL || events == NULL) {
+        perror(state.notify_fd == -1 ? "inotify_init1" : "malloc");
+        if (state.notify_fd != -1) close(state.notify_fd);
+        free(followed);
+        free(events);
+        return 1;
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        const char *slash = strrchr(files[i], '/');
+        FollowedFile *file = &followed[i];
+
+        file->path = files[i];
+        file->name = (slash != NULL) ? slash + 1 : files[i];
+        file->fd = -1;
+        file->watch = -1;
+        file->directory_watch = directory_watch_for(&state, files[i]);
+        if (context->report_mode == REPORT_LINES && context->after_context >= 0) {
+            SearchContext file_context = *context;
+            file_context.source_name = files[i];
+            file->with_context = (context_printer_init(&file->printer, &file_context) == 0);
+        }
+        if (open_followed_file(&state, file, 1) != 0) {
+            fprintf(stderr, "Cannot open '%s': ", files[i]);
+            perror("");
+        }
+    }
+
+    while (anything_followed(followed, file_count) &&
+           !(state.found && context->report_mode == REPORT_QUIET)) {
+        ssize_t bytes_read = read(state.notify_fd, events, FOLLOW_EVENT_BUFFER_SIZE);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            perror("inotify");
+            break;
+        }
+
+        for (ssize_t offset = 0; offset < bytes_read;) {
+            const struct inotify_event *event = (const struct inotify_event *)(events + offset);
+            handle_event(&state, followed, file_count, event);
+            offset += (ssize_t)(sizeof(struct inotify_event) + event->len);
+        }
+        output_flush(context->output);
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        close_followed_file(&state, &followed[i]);
+        if (followed[i].with_context) context_printer_release(&followed[i].printer);
+        free(followed[i].pending);
+    }
+    close(state.notify_fd);
+    free(followed);
+    free(events);
+    return state.found ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#ifndef FOLLOW_SEARCH_H
+#define FOLLOW_SEARCH_H
+
+#include "search_engine.h"
+
+#define FOLLOW_READ_SIZE (64 * 1024)
+#define FOLLOW_EVENT_BUFFER_SIZE (64 * 1024)
+
+// Follow files[0..file_count) as they grow and search every line appended
+// after the start, like tail -n 0 -F piped into a search. inotify wakes the
+// loop up, so there is no polling. A file that shrinks is searched again
+// from its start; a file that is moved or deleted and then created again
+// under its name (log rotation) is searched from the start of the new
+// file once the old one is drained. Only REPORT_LINES and REPORT_QUIET are
+// meaningful; output is flushed after every wakeup.
+// Runs until every file is gone for good, or with REPORT_QUIET until the
+// first match (returns 0). Returns 1 otherwise.
+int follow_files_pattern(const SearchContext *context, char *const files[], int file_count);
+
+#endif
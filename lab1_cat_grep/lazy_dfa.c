@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lazy_dfa.h"
+
+#define STATE_MATCH 0x01          // a match ends at the byte just read
+#define STATE_MATCH_AT_EOL 0x02   // a match ends if the line ends here
+#define STATE_DEAD 0x04           // nothing can match before the next line
+#define STATE_LINE_START 0x08
+
+#define CONTEXT_LINE_START 0x01
+#define CONTEXT_LINE_END 0x02
+
+#define UNKNOWN_STATE UINT32_MAX
+#define LINE_START_ROW 0          // the line start state is always created first
+
+typedef struct {
+    uint32_t first_node;          // offset into node_pool
+    uint32_t node_count;
+    uint32_t hash;
+} DfaState;
+
+struct LazyDfa {
+    const RegexProgram *program;
+    size_t row_width;             // flags, then one transition per byte class
+    uint32_t *table;              // premultiplied row offsets, UNKNOWN_STATE until computed
+    size_t table_len;
+    size_t table_capacity;
+    DfaState *states;
+    size_t state_count;
+    size_t state_capacity;
+    uint32_t *node_pool;          // sorted NFA node sets of all states
+    size_t pool_len;
+    size_t pool_capacity;
+    uint32_t *slots;              // open addressing over states, index + 1 (0 = empty)
+    size_t slot_count;
+
+    // Scratch space sized by the program
+    uint32_t *marks;
+    uint32_t generation;
+    uint32_t *stack;
+    uint32_t *seeds;
+    uint32_t *nodes;
+};
+
+static int compare_nodes(const void *left, const void *right) {
+    uint32_t a = *(const uint32_t *)left;
+    uint32_t b = *(const uint32_t *)right;
+    return (a > b) - (a < b);
+}
+
+static void push_node(LazyDfa *dfa, size_t *depth, uint32_t node) {
+    if (dfa->marks[node] == dfa->generation) return;
+    dfa->marks[node] = dfa->generation;
+    dfa->stack[(*depth)++] = node;
+}
+
+// Collect the byte-consuming nodes reachable from seeds without reading
+// a byte; returns whether the match node is reachable. nodes may be NULL.
+static int follow_epsilons(LazyDfa *dfa, const uint32_t *seeds, size_t seed_count, int context,
+                           uint32_t *nodes, size_t *node_count) {
+    const RegexNode *program_nodes = dfa->program->nodes;
+    size_t depth = 0;
+    size_t found = 0;
+    int matched = 0;
+
+    if (++dfa->generation == 0) {
+        memset(dfa->marks, 0, dfa->program->node_count * sizeof(uint32_t));
+        dfa->generation = 1;
+    }
+
+    for (size_t i = 0; i < seed_count; i++) {
+        push_node(dfa, &depth, seeds[i]);
+    }
+
+    while (depth > 0) {
+        uint32_t index = dfa->stack[--depth];
+        const RegexNode *node = &program_nodes[index];
+
+        switch (node->type) {
+            case REGEX_NODE_SET:
+                if (nodes != NULL) nodes[found++] = index;
+                break;
+            case REGEX_NODE_SPLIT:
+                push_node(dfa, &depth, node->alt);
+                push_node(dfa, &depth, node->out);
+                break;
+            case REGEX_NODE_LINE_START:
+                if (context & CONTEXT_LINE_START) push_node(dfa, &depth, node->out);
+                break;
+            case REGEX_NODE_LINE_END:
+                if (context & CONTEXT_LINE_END) push_node(dfa, &depth, node->out);
+                break;
+            case REGEX_NODE_MATCH:
+                matched = 1;
+                break;
+        }
+    }
+
+    if (node_count != NULL) *node_count = found;
+    return matched;
+}
+
+static uint32_t hash_state(const uint32_t *nodes, size_t node_count, uint32_t flags) {
+    uint32_t hash = 2166136261U ^ flags;  // FNV-1a over the node numbers
+    for (size_t i = 0; i < node_count; i++) {
+        hash = (hash ^ nodes[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// Only what is filled counts against the budget; a flushed cache keeps its allocations
+static size_t cache_size(const LazyDfa *dfa) {
+    return (dfa->table_len + dfa->pool_len + dfa->slot_count) * sizeof(uint32_t) +
+           dfa->state_count * sizeof(DfaState);
+}
+
+static int grow_state_slots(LazyDfa *dfa) {
+    size_t slot_count = dfa->slot_count ? dfa->slot_count * 2 : 256;
+    uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL) return -1;
+
+    for (size_t i = 0; i < dfa->state_count; i++) {
+        size_t slot = dfa->states[i].hash & (slot_count - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (uint32_t)i + 1;
+    }
+
+    free(dfa->slots);
+    dfa->slots = slots;
+    dfa->slot_count = slot_count;
+    return 0;
+}
+
+static int reserve(void **buffer, size_t *capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) return 0;
+
+    size_t grown_capacity = *capacity ? *capacity : 256;
+    while (grown_capacity < needed) grown_capacity *= 2;
+
+    void *grown = realloc(*buffer, grown_capacity * element_size);
+    if (grown == NULL) return -1;
+    *buffer = grown;
+    *capacity = grown_capacity;
+    return 0;
+}
+
+// Row offset of the state for a sorted node set, created if needed
+static uint32_t intern_state(LazyDfa *dfa, const uint32_t *nodes, size_t node_count, uint32_t flags) {
+    uint32_t hash = hash_state(nodes, node_count, flags);
+
+    if ((dfa->state_count + 1) * 2 > dfa->slot_count && grow_state_slots(dfa) != 0) return UNKNOWN_STATE;
+
+    size_t slot = hash & (dfa->slot_count - 1);
+    for (; dfa->slots[slot] != 0; slot = (slot + 1) & (dfa->slot_count - 1)) {
+        size_t index = dfa->slots[slot] - 1;
+        const DfaState *state = &dfa->states[index];
+        uint32_t row = (uint32_t)(index * dfa->row_width);
+
+        if (state->hash == hash && state->node_count == node_count && dfa->table[row] == flags &&
+            (node_count == 0 ||
+             memcmp(dfa->node_pool + state->first_node, nodes, node_count * sizeof(uint32_t)) == 0)) {
+            return row;
+        }
+    }
+
+    size_t row = dfa->table_len;
+    if (row + dfa->row_width >= UNKNOWN_STATE ||
+        reserve((void **)&dfa->table, &dfa->table_capacity, row + dfa->row_width, sizeof(uint32_t)) != 0 ||
+        reserve((void **)&dfa->node_pool, &dfa->pool_capacity, dfa->pool_len + node_count, sizeof(uint32_t)) != 0 ||
+        reserve((void **)&dfa->states, &dfa->state_capacity, dfa->state_count + 1, sizeof(DfaState)) != 0) {
+        return UNKNOWN_STATE;
+    }
+
+    DfaState *state = &dfa->states[dfa->state_count];
+    state->first_node = (uint32_t)dfa->pool_len;
+    state->node_count = (uint32_t)node_count;
+    state->hash = hash;
+    if (node_count > 0) memcpy(dfa->node_pool + dfa->pool_len, nodes, node_count * sizeof(uint32_t));
+    dfa->pool_len += node_count;
+
+    dfa->table[row] = flags;
+    for (size_t i = 1; i < dfa->row_width; i++) {
+        dfa->table[row + i] = UNKNOWN_STATE;
+    }
+    dfa->table_len += dfa->row_width;
+
+    dfa->slots[slot] = (uint32_t)++dfa->state_count;
+    return (uint32_t)row;
+}
+
+static uint32_t state_for_seeds(LazyDfa *dfa, const uint32_t *seeds, size_t seed_count, int context) {
+    size_t node_count;
+    uint32_t flags = 0;
+
+    if (follow_epsilons(dfa, seeds, seed_count, context, dfa->nodes, &node_count)) {
+        flags |= STATE_MATCH;
+    }
+    if (follow_epsilons(dfa, seeds, seed_count, context | CONTEXT_LINE_END, NULL, NULL)) {
+        flags |= STATE_MATCH_AT_EOL;
+    }
+    if (node_count == 0 && flags == 0) flags |= STATE_DEAD;
+    if (context & CONTEXT_LINE_START) flags |= STATE_LINE_START;
+
+    qsort(dfa->nodes, node_count, sizeof(uint32_t), compare_nodes);
+    return intern_state(dfa, dfa->nodes, node_count, flags);
+}
+
+// Drop every state and start over with just the line start state
+static int reset_cache(LazyDfa *dfa) {
+    uint32_t start = dfa->program->start;
+
+    dfa->table_len = 0;
+    dfa->pool_len = 0;
+    dfa->state_count = 0;
+    if (dfa->slots != NULL) memset(dfa->slots, 0, dfa->slot_count * sizeof(uint32_t));
+
+    return (state_for_seeds(dfa, &start, 1, CONTEXT_LINE_START) == LINE_START_ROW) ? 0 : -1;
+}
+
+static uint32_t compute_transition(LazyDfa *dfa, uint32_t row, size_t byte_class) {
+    const RegexProgram *program = dfa->program;
+    const DfaState *state = &dfa->states[row / dfa->row_width];
+    unsigned char byte = program->class_byte[byte_class];
+    size_t seed_count = 0;
+    uint32_t next;
+    int flushed = 0;
+
+    if (byte == '\n') {
+        // A newline ends the line: either a match was pending there, or
+        // the next line starts from scratch
+        if (!(dfa->table[row] & STATE_MATCH_AT_EOL)) return LINE_START_ROW;
+        next = intern_state(dfa, dfa->nodes, 0, STATE_MATCH);
+    } else {
+        for (uint32_t i = 0; i < state->node_count; i++) {
+            uint32_t index = dfa->node_pool[state->first_node + i];
+            if (regex_set_contains(program, program->nodes[index].alt, byte)) {
+                dfa->seeds[seed_count++] = program->nodes[index].out;
+            }
+        }
+        // A match may also begin right after this byte
+        dfa->seeds[seed_count++] = program->start;
+
+        if (cache_size(dfa) > DFA_CACHE_BUDGET) {
+            flushed = 1;
+            if (reset_cache(dfa) != 0) return UNKNOWN_STATE;
+        }
+        next = state_for_seeds(dfa, dfa->seeds, seed_count, 0);
+    }
+
+    if (next != UNKNOWN_STATE && !flushed) dfa->table[row + 1 + byte_class] = next;
+    return next;
+}
+
+LazyDfa *lazy_dfa_create(const RegexProgram *program) {
+    LazyDfa *dfa = (LazyDfa *)calloc(1, sizeof(LazyDfa));
+    if (dfa == NULL) return NULL;
+
+    dfa->program = program;
+    dfa->row_width = program->class_count + 1;
+    dfa->marks = (uint32_t *)calloc(program->node_count, sizeof(uint32_t));
+    dfa->stack = (uint32_t *)malloc(program->node_count * sizeof(uint32_t));
+    dfa->seeds = (uint32_t *)malloc((program->node_count + 1) * sizeof(uint32_t));
+    dfa->nodes = (uint32_t *)malloc(program->node_count * sizeof(uint32_t));
+
+    if (dfa->marks == NULL || dfa->stack == NULL || dfa->seeds == NULL || dfa->nodes == NULL ||
+        reset_cache(dfa) != 0) {
+        lazy_dfa_free(dfa);
+        return NULL;
+    }
+    return dfa;
+}
+
+const char *lazy_dfa_find(LazyDfa *dfa, const char *text, size_t length) {
+    const unsigned char *byte_class = dfa->program->byte_class;
+    const unsigned char *cursor = (const unsigned char *)text;
+    const unsigned char *end = cursor + length;
+    const uint32_t *table = dfa->table;
+    uint32_t row = LINE_START_ROW;
+
+    if (length == 0) return NULL;
+    if (table[LINE_START_ROW] & STATE_MATCH) return text;  // every line matches
+
+    while (cursor < end) {
+        uint32_t next = table[row + 1 + byte_class[*cursor]];
+
+        if (next == UNKNOWN_STATE) {
+            next = compute_transition(dfa, row, byte_class[*cursor]);
+            if (next == UNKNOWN_STATE) {
+                fprintf(stderr, "Not enough memory for the regex cache\n");
+                return NULL;
+            }
+            table = dfa->table;
+        }
+
+        row = next;
+        cursor++;
+
+        if (table[row] & (STATE_MATCH | STATE_DEAD)) {
+            if (table[row] & STATE_MATCH) return (const char *)cursor - 1;
+            cursor = memchr(cursor, '\n', end - cursor);
+            if (cursor == NULL) return NULL;
+        }
+    }
+
+    // The last line may lack its newline
+    if (end[-1] != '\n' && (table[row] & STATE_MATCH_AT_EOL)) return (const char *)end - 1;
+    return NULL;
+}
+
+void lazy_dfa_free(LazyDfa *dfa) {
+    if (dfa == NULL) return;
+    free(dfa->table);
+    free(dfa->states);
+    free(dfa->node_pool);
+    free(dfa->slots);
+    free(dfa->marks);
+    free(dfa->stack);
+    free(dfa->seeds);
+    free(dfa->nodes);
+    free(dfa);
+}
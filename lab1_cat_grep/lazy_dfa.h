@@ -0,0 +1,26 @@
+#ifndef LAZY_DFA_H
+#define LAZY_DFA_H
+
+#include <stddef.h>
+#include "regex_program.h"
+
+#define DFA_CACHE_BUDGET (4 * 1024 * 1024)
+
+// DFA over a RegexProgram whose states are built on first use. Each state
+// is the set of NFA nodes a line prefix can be in, so matching costs one
+// table lookup per byte no matter how much the pattern alternates. When
+// the cache outgrows DFA_CACHE_BUDGET it is emptied and refilled as the
+// scan goes on, which bounds memory while keeping the scan linear.
+// The program may be shared between threads, the cache may not.
+typedef struct LazyDfa LazyDfa;
+
+// Returns NULL on allocation failure.
+LazyDfa *lazy_dfa_create(const RegexProgram *program);
+
+// text starts at the beginning of a line. Returns a pointer into the first
+// line containing a match (possibly at its newline), or NULL.
+const char *lazy_dfa_find(LazyDfa *dfa, const char *text, size_t length);
+
+void lazy_dfa_free(LazyDfa *dfa);
+
+#endif
@@ -0,0 +1,180 @@
+#define _GNU_SOURCE  // for memmem()
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "literal_search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define ERE_METACHARS ".[]()*+?{}|^$\\"
+
+typedef const char *(*literal_finder)(const char *, size_t, const char *, size_t);
+typedef size_t (*newline_counter)(const char *, size_t);
+
+static const char *find_literal_scalar(const char *haystack, size_t haystack_len,
+                                       const char *needle, size_t needle_len) {
+    return memmem(haystack, haystack_len, needle, needle_len);
+}
+
+static size_t count_newlines_scalar(const char *data, size_t length) {
+    const char *end = data + length;
+    size_t count = 0;
+
+    while ((data = memchr(data, '\n', end - data)) != NULL) {
+        count++;
+        data++;
+    }
+    return count;
+}
+
+#ifdef HAVE_X86_SIMD
+// Compare the first and the last needle byte against 16/32 candidate
+// positions at once and verify only the positions where both agree.
+__attribute__((target("sse2")))
+static const char *find_literal_sse2(const char *haystack, size_t haystack_len,
+                                     const char *needle, size_t needle_len) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t pos = 0;
+
+    while (pos + needle_len + 15 <= haystack_len) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(haystack + pos));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(haystack + pos + needle_len - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                              _mm_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(haystack + pos + bit + 1, needle + 1, needle_len - 2) == 0) {
+                return haystack + pos + bit;
+            }
+            mask &= mask - 1;
+        }
+        pos += 16;
+    }
+
+    return find_literal_scalar(haystack + pos, haystack_len - pos, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static const char *find_literal_avx2(const char *haystack, size_t haystack_len,
+                                     const char *needle, size_t needle_len) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t pos = 0;
+
+    while (pos + needle_len + 31 <= haystack_len) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(haystack + pos));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(haystack + pos + needle_len - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                 _mm256_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(haystack + pos + bit + 1, needle + 1, needle_len - 2) == 0) {
+                return haystack + pos + bit;
+            }
+            mask &= mask - 1;
+        }
+        pos += 32;
+    }
+
+    return find_literal_sse2(haystack + pos, haystack_len - pos, needle, needle_len);
+}
+
+__attribute__((target("sse2,popcnt")))
+static size_t count_newlines_sse2(const char *data, size_t length) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + pos));
+        count += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+    }
+    return count + count_newlines_scalar(data + pos, length - pos);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_newlines_avx2(const char *data, size_t length) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + pos));
+        count += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+    }
+    return count + count_newlines_scalar(data + pos, length - pos);
+}
+#endif
+
+static literal_finder selected_finder = find_literal_scalar;
+static newline_counter selected_counter = count_newlines_scalar;
+static pthread_once_t finder_once = PTHREAD_ONCE_INIT;
+
+static void select_finder(void) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        selected_finder = find_literal_avx2;
+        selected_counter = count_newlines_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        selected_finder = find_literal_sse2;
+        if (__builtin_cpu_supports("popcnt")) selected_counter = count_newlines_sse2;
+    }
+#endif
+}
+
+const char *find_literal(const char *haystack, size_t haystack_len,
+                         const char *needle, size_t needle_len) {
+    if (needle_len == 0) return haystack;
+    if (needle_len > haystack_len) return NULL;
+    if (needle_len == 1) return memchr(haystack, (unsigned char)needle[0], haystack_len);
+
+    pthread_once(&finder_once, select_finder);
+    return selected_finder(haystack, haystack_len, needle, needle_len);
+}
+
+size_t count_newlines(const char *data, size_t length) {
+    pthread_once(&finder_once, select_finder);
+    return selected_counter(data, length);
+}
+
+int extract_plain_literal(const char *pattern, char **literal_out, size_t *literal_len) {
+    size_t pattern_len = strlen(pattern);
+    char *literal = (char *)malloc(pattern_len + 1);
+    size_t out = 0;
+
+    if (literal == NULL) return 0;
+
+    for (size_t i = 0; i < pattern_len; i++) {
+        char current = pattern[i];
+
+        if (current == '\\') {
+            // Only escaped metacharacters are plain; \w, \1 and friends are not
+            if (i + 1 < pattern_len && strchr(ERE_METACHARS, pattern[i + 1]) != NULL) {
+                literal[out++] = pattern[++i];
+                continue;
+            }
+            free(literal);
+            return 0;
+        }
+
+        if (strchr(ERE_METACHARS, current) != NULL) {
+            free(literal);
+            return 0;
+        }
+        literal[out++] = current;
+    }
+
+    literal[out] = '\0';
+    *literal_out = literal;
+    *literal_len = out;
+    return 1;
+}
@@ -0,0 +1,19 @@
+#ifndef LITERAL_SEARCH_H
+#define LITERAL_SEARCH_H
+
+#include <stddef.h>
+
+// Find the first occurrence of needle in haystack (SSE2/AVX2 when available).
+// Returns NULL if there is no occurrence. An empty needle matches at haystack.
+const char *find_literal(const char *haystack, size_t haystack_len,
+                         const char *needle, size_t needle_len);
+
+// Number of '\n' bytes in data (SSE2/AVX2 when available).
+size_t count_newlines(const char *data, size_t length);
+
+// Check whether an ERE pattern is a plain string (no metacharacters).
+// Escaped metacharacters are unescaped into the result.
+// Returns 1 and stores a malloc'd copy in literal_out on success, 0 otherwise.
+int extract_plain_literal(const char *pattern, char **literal_out, size_t *literal_len);
+
+#endif
@@ -1,74 +1,154 @@
-#define _GNU_SOURCE  // for getline()
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <getopt.h>  // for getopt_long()
-#include <unistd.h>
-#include <regex.h>
 #include <ctype.h>
+#include "block_reader.h"
+#include "fd_copy.h"
+#include "text_transform.h"
+#include "search_pattern.h"
+#include "search_engine.h"
+#include "search_pool.h"
+#include "tree_search.h"
+#include "file_batch.h"
+#include "follow_search.h"
+#include "context_lines.h"
+
+#define MAX_SEARCH_WORKERS 1024
+#define FOLLOW_OPTION 256  // long option only: -F already means --fixed-strings
+#define LINE_BUFFERED_OPTION 257
 
-#define LINE_NUM_FLAG 0x01
-#define NONBLANK_NUM_FLAG 0x02
-#define END_MARKER_FLAG 0x04
 
 typedef struct {
     int options;
     int exit_code;
 } AppState;
 
-// ==================== TEXT PROCESSOR (CAT-LIKE) ====================
-void display_text_line(char *text_buffer, size_t length, int options_set, int *counter) {
-    int line_is_empty = (text_buffer[0] == '\n' || length == 0);
-
-    // Handle line numbering
-    if ((options_set & NONBLANK_NUM_FLAG) && !line_is_empty) {
-        printf("%6d\t", (*counter)++);
-    } else if ((options_set & LINE_NUM_FLAG) && !(options_set & NONBLANK_NUM_FLAG)) {
-        printf("%6d\t", (*counter)++);
-    }
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} PatternList;
 
-    // Handle end-of-line markers
-    if (options_set & END_MARKER_FLAG) {
-        if (length > 0 && text_buffer[length - 1] == '\n') {
-            text_buffer[length - 1] = '\0';
-            printf("%s$\n", text_buffer);
-        } else {
-            printf("%s$\n", text_buffer);
+// ==================== TEXT PROCESSOR (CAT-LIKE) ====================
+static int transform_blocks(TextTransform *transform, BlockReader *reader, const char *source_name) {
+    TextSpan block;
+
+    while (block_reader_next(reader, &block) > 0) {
+        if (text_transform_block(transform, block) != 0) {
+            fprintf(stderr, "Error writing '%s': ", source_name);
+            perror("");
+            return 1;
         }
-    } else {
-        printf("%s", text_buffer);
     }
+    return 0;
 }
 
-void stream_text_display(FILE *input_stream, int options_set) {
-    char *buffer_ptr = NULL;
-    size_t buffer_size = 0;
-    ssize_t bytes_read;
-    int current_line = 1;
+// A mapped file that shrinks while it is copied ends where it was cut;
+// the lines of the block in progress that were not written yet are lost
+static int transform_blocks_guarded(TextTransform *transform, BlockReader *reader, const char *source_name) {
+    sigjmp_buf fault_jump;
+
+    if (!reader->mapped) return transform_blocks(transform, reader, source_name);
+    if (sigsetjmp(fault_jump, 1) != 0) return 0;
 
-    while ((bytes_read = getline(&buffer_ptr, &buffer_size, input_stream)) != -1) {
-        display_text_line(buffer_ptr, bytes_read, options_set, &current_line);
+    mapped_read_begin(&fault_jump);
+    int status = transform_blocks(transform, reader, source_name);
+    mapped_read_end();
+    return status;
+}
+
+int stream_text_display(int input_fd, const char *source_name, int options_set) {
+    BlockReader reader;
+    TextTransform transform;
+    int status = 0;
+
+    // Nothing to transform: let the kernel move the bytes
+    if (options_set == 0) {
+        fflush(stdout);
+        if (copy_descriptor(input_fd, STDOUT_FILENO) != 0) {
+            fprintf(stderr, "Error copying '%s': ", source_name);
+            perror("");
+            return 1;
+        }
+        return 0;
     }
 
-    if (buffer_ptr != NULL) free(buffer_ptr);
+    if (block_reader_init(&reader, input_fd) != 0) {
+        perror("malloc");
+        return 1;
+    }
+    if (text_transform_init(&transform, STDOUT_FILENO, options_set) != 0) {
+        perror("malloc");
+        block_reader_release(&reader);
+        return 1;
+    }
+
+    fflush(stdout);
+    status = transform_blocks_guarded(&transform, &reader, source_name);
+
+    text_transform_release(&transform);
+    block_reader_release(&reader);
+    return status;
 }
 
 int process_text_file(const char *filename, int options_set) {
-    FILE *input_file = fopen(filename, "r");
-    if (input_file == NULL) {
+    int input_fd = open(filename, O_RDONLY);
+    if (input_fd == -1) {
         fprintf(stderr, "Error opening '%s': ", filename);
         perror("");
         return 1;
     }
 
-    stream_text_display(input_file, options_set);
-    fclose(input_file);
-    return 0;
+    int status = stream_text_display(input_fd, filename, options_set);
+    close(input_fd);
+    return status;
+}
+
+// The whole file is already in memory (read ahead by a FileBatch)
+static int display_text_span(TextSpan input, const char *source_name, int options_set) {
+    TextTransform transform;
+    int status = 0;
+
+    fflush(stdout);
+    if (options_set == 0) {
+        while (status == 0 && input.length > 0) {
+            ssize_t written = write(STDOUT_FILENO, input.data, input.length);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0) {
+                status = 1;
+                break;
+            }
+            input.data += written;
+            input.length -= (size_t)written;
+        }
+    } else if (text_transform_init(&transform, STDOUT_FILENO, options_set) != 0) {
+        perror("malloc");
+        return 1;
+    } else {
+        status = (text_transform_block(&transform, input) != 0);
+        text_transform_release(&transform);
+    }
+
+    if (status != 0) {
+        fprintf(stderr, "Error writing '%s': ", source_name);
+        perror("");
+    }
+    return status;
 }
 
-void process_text_input(int options_set) {
-    stream_text_display(stdin, options_set);
+static int process_batch_file(const BatchFile *file, int options_set) {
+    if (file->complete) return display_text_span(file->data, file->path, options_set);
+    if (file->fd >= 0) return stream_text_display(file->fd, file->path, options_set);
+    return process_text_file(file->path, options_set);
+}
+
+int process_text_input(int options_set) {
+    return stream_text_display(STDIN_FILENO, "-", options_set);
 }
 
 int text_processor_main(int arg_count, char *arg_values[]) {
@@ -104,93 +184,301 @@ int text_processor_main(int arg_count, char *arg_values[]) {
     }
 
     if (optind == arg_count) {
-        process_text_input(selected_options);
+        app_state.exit_code = process_text_input(selected_options);
     } else {
+        // Many files are opened and read ahead through io_uring when available
+        int file_count = arg_count - optind;
+        FileBatch *batch = (file_count >= BATCH_MIN_FILES) ? file_batch_open(arg_values + optind, file_count) : NULL;
+        BatchFile file;
+
         for (int idx = optind; idx < arg_count; idx++) {
-            app_state.exit_code |= process_text_file(arg_values[idx], selected_options);
+            if (batch != NULL && file_batch_next(batch, &file) > 0) {
+                app_state.exit_code |= process_batch_file(&file, selected_options);
+            } else {
+                app_state.exit_code |= process_text_file(arg_values[idx], selected_options);
+            }
         }
+        if (batch != NULL) file_batch_close(batch);
     }
 
     return app_state.exit_code;
 }
 
 // ==================== PATTERN SEARCHER (GREP-LIKE) ====================
-int search_stream_pattern(regex_t *compiled_regex, FILE *input_stream,
-                          const char *source_name, int multi_source) {
-    char *line_buffer = NULL;
-    size_t buffer_capacity = 0;
-    int found_status = 0;
-
-    while (getline(&line_buffer, &buffer_capacity, input_stream) != -1) {
-        if (regexec(compiled_regex, line_buffer, 0, NULL, 0) == 0) {
-            if (multi_source && source_name != NULL) {
-                printf("%s:%s", source_name, line_buffer);
-            } else {
-                printf("%s", line_buffer);
-            }
-            found_status = 1;
+int search_input_pattern(const SearchContext *context) {
+    return search_stream_pattern(context, STDIN_FILENO);
+}
+
+static int add_search_pattern(PatternList *list, const char *text, size_t length) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 8;
+        char **grown = (char **)realloc(list->items, capacity * sizeof(char *));
+        if (grown == NULL) {
+            perror("realloc");
+            return 1;
         }
+        list->items = grown;
+        list->capacity = capacity;
     }
 
-    if (line_buffer != NULL) free(line_buffer);
-    return found_status ? 0 : 1;
+    list->items[list->count] = strndup(text, length);
+    if (list->items[list->count] == NULL) {
+        perror("strndup");
+        return 1;
+    }
+    list->count++;
+    return 0;
 }
 
-int search_file_pattern(const char *search_pattern, const char *filename, int multi_source) {
-    FILE *input_file = fopen(filename, "r");
-    if (input_file == NULL) {
+// One pattern per line; an empty file contributes no patterns
+static int read_pattern_file(PatternList *list, const char *filename) {
+    FILE *pattern_file = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_len;
+    int status = 0;
+
+    if (pattern_file == NULL) {
         fprintf(stderr, "Cannot open '%s': ", filename);
         perror("");
         return 1;
     }
 
-    regex_t pattern_regex;
-    int compile_result = regcomp(&pattern_regex, search_pattern, REG_EXTENDED);
-
-    if (compile_result != 0) {
-        fprintf(stderr, "Pattern compilation failed\n");
-        fclose(input_file);
-        return 1;
+    while (status == 0 && (line_len = getline(&line, &line_capacity, pattern_file)) != -1) {
+        if (line_len > 0 && line[line_len - 1] == '\n') line_len--;
+        status = add_search_pattern(list, line, (size_t)line_len);
     }
 
-    int search_result = search_stream_pattern(&pattern_regex, input_file, filename, multi_source);
-
-    regfree(&pattern_regex);
-    fclose(input_file);
+    free(line);
+    if (pattern_file != stdin) fclose(pattern_file);
+    return status;
+}
 
-    return search_result;
+static void release_pattern_list(PatternList *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
 }
 
-void search_input_pattern(const char *search_pattern) {
-    regex_t pattern_regex;
+// For -A, -B and -C
+static int parse_context_lines(const char *text, int *lines) {
+    char *number_end;
+    long value = strtol(text, &number_end, 10);
 
-    if (regcomp(&pattern_regex, search_pattern, REG_EXTENDED) != 0) {
-        fprintf(stderr, "Pattern compilation failed\n");
-        return;
+    if (*text == '\0' || *number_end != '\0' || value < 0 || value > MAX_CONTEXT_LINES) {
+        fprintf(stderr, "Invalid context length '%s'\n", text);
+        return 1;
     }
+    *lines = (int)value;
+    return 0;
+}
 
-    search_stream_pattern(&pattern_regex, stdin, NULL, 0);
-    regfree(&pattern_regex);
+static int searcher_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-F] [-a] [-n] [-r | --follow] [-c | -l | -q] [-A N] [-B N] [-C N] [--line-buffered] [-j N] [-e PATTERN] [-f FILE] [search_pattern] [file...]\n", program);
+    return 1;
 }
 
 int pattern_searcher_main(int arg_count, char *arg_values[]) {
-    if (arg_count < 2) {
-        fprintf(stderr, "Usage: %s search_pattern [file...]\n", arg_values[0]);
+    int current_option;
+    int fixed_strings = 0;
+    int line_numbers = 0;
+    int binary_as_text = 0;
+    int report_mode = REPORT_LINES;
+    int recursive = 0;
+    int follow = 0;
+    int line_buffered = 0;
+    int before_context = -1;
+    int after_context = -1;
+    int both_context = -1;
+    long worker_count = 1;
+    char *number_end;
+    PatternList patterns = {NULL, 0, 0};
+    int explicit_patterns = 0;
+    int option_failed = 0;
+
+    struct option long_opts[] = {
+            {"regexp", 1, NULL, 'e'},
+            {"file", 1, NULL, 'f'},
+            {"fixed-strings", 0, NULL, 'F'},
+            {"text", 0, NULL, 'a'},
+            {"count", 0, NULL, 'c'},
+            {"files-with-matches", 0, NULL, 'l'},
+            {"quiet", 0, NULL, 'q'},
+            {"silent", 0, NULL, 'q'},
+            {"recursive", 0, NULL, 'r'},
+            {"jobs", 1, NULL, 'j'},
+            {"follow", 0, NULL, FOLLOW_OPTION},
+            {"line-buffered", 0, NULL, LINE_BUFFERED_OPTION},
+            {"line-number", 0, NULL, 'n'},
+            {"after-context", 1, NULL, 'A'},
+            {"before-context", 1, NULL, 'B'},
+            {"context", 1, NULL, 'C'},
+            {NULL, 0, NULL, 0}
+    };
+
+    optind = 1;
+
+    while (!option_failed &&
+           (current_option = getopt_long(arg_count, arg_values, "A:B:C:ace:f:Fj:lnqr", long_opts, NULL)) != -1) {
+        switch (current_option) {
+            case 'e':
+                explicit_patterns = 1;
+                option_failed = add_search_pattern(&patterns, optarg, strlen(optarg));
+                break;
+            case 'f':
+                explicit_patterns = 1;
+                option_failed = read_pattern_file(&patterns, optarg);
+                break;
+            case 'F':
+                fixed_strings = 1;
+                break;
+            case 'a':
+                binary_as_text = 1;
+                break;
+            // -q beats -l, which beats -c, whatever the order
+            case 'c':
+                if (report_mode == REPORT_LINES) report_mode = REPORT_COUNT;
+                break;
+            case 'l':
+                if (report_mode != REPORT_QUIET) report_mode = REPORT_FILES;
+                break;
+            case 'q':
+                report_mode = REPORT_QUIET;
+                break;
+            case 'r':
+                recursive = 1;
+                break;
+            case FOLLOW_OPTION:
+                follow = 1;
+                break;
+            case LINE_BUFFERED_OPTION:
+                line_buffered = 1;
+                break;
+            case 'j':
+                // -j 0 means one worker per online CPU
+                worker_count = strtol(optarg, &number_end, 10);
+                if (*number_end != '\0' || worker_count < 0 || worker_count > MAX_SEARCH_WORKERS) {
+                    fprintf(stderr, "Invalid worker count '%s'\n", optarg);
+                    option_failed = 1;
+                    break;
+                }
+                if (worker_count == 0) worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+                break;
+            case 'n':
+                line_numbers = 1;
+                break;
+            case 'A':
+                option_failed = parse_context_lines(optarg, &after_context);
+                break;
+            case 'B':
+                option_failed = parse_context_lines(optarg, &before_context);
+                break;
+            case 'C':
+                option_failed = parse_context_lines(optarg, &both_context);
+                break;
+            default:
+                option_failed = searcher_usage(arg_values[0]);
+                break;
+        }
+    }
+
+    // -A and -B win over -C, whatever the order; both stay -1 without any
+    if (before_context < 0) before_context = both_context;
+    if (after_context < 0) after_context = both_context;
+    if (before_context >= 0 || after_context >= 0) {
+        if (before_context < 0) before_context = 0;
+        if (after_context < 0) after_context = 0;
+    }
+
+    // Without -e or -f the first operand is the pattern
+    if (!option_failed && !explicit_patterns) {
+        if (optind >= arg_count) {
+            option_failed = searcher_usage(arg_values[0]);
+        } else {
+            option_failed = add_search_pattern(&patterns, arg_values[optind], strlen(arg_values[optind]));
+            optind++;
+        }
+    }
+
+    // Followed files never end, so there is no count or file list to report
+    if (!option_failed && follow &&
+        (recursive || optind >= arg_count || report_mode == REPORT_COUNT || report_mode == REPORT_FILES)) {
+        fprintf(stderr, "--follow needs file operands and cannot be combined with -r, -c or -l\n");
+        option_failed = 1;
+    }
+
+    if (option_failed) {
+        release_pattern_list(&patterns);
         return 1;
     }
 
-    const char *target_pattern = arg_values[1];
+    int first_file = optind;
     int overall_status = 0;
-    int multiple_sources = (arg_count > 3);
+    int multiple_sources = (arg_count - first_file > 1) || recursive;
+
+    // Analyzed and compiled once, shared by every file argument
+    SearchPattern pattern;
+    int prepare_status = prepare_search_pattern(&pattern, patterns.items, patterns.count, fixed_strings);
+    release_pattern_list(&patterns);
+    if (prepare_status != 0) {
+        return 1;
+    }
 
-    if (arg_count == 2) {
-        search_input_pattern(target_pattern);
+    // A terminal sees every line as soon as it is found
+    OutputBuffer output;
+    if (output_init(&output, STDOUT_FILENO, line_buffered || isatty(STDOUT_FILENO)) != 0) {
+        perror("malloc");
+        release_search_pattern(&pattern);
+        return 1;
+    }
+
+    int printed_groups = 0;
+    SearchContext context = {&pattern, NULL, multiple_sources, line_numbers, report_mode,
+                             binary_as_text, recursive, 0, before_context, after_context,
+                             &output, &printed_groups, NULL, NULL};
+
+    if (follow) {
+        overall_status = follow_files_pattern(&context, arg_values + first_file, arg_count - first_file);
+    } else if (recursive) {
+        // Without operands -r searches the working directory
+        char *default_root[] = {"."};
+        int root_count = arg_count - first_file;
+        overall_status = search_tree_parallel(&context, root_count > 0 ? arg_values + first_file : default_root,
+                                              root_count > 0 ? root_count : 1, (int)worker_count);
+    } else if (first_file == arg_count) {
+        overall_status = search_input_pattern(&context);
+    } else if (worker_count > 1) {
+        overall_status = search_files_parallel(&context, arg_values + first_file,
+                                               arg_count - first_file, (int)worker_count);
     } else {
-        for (int idx = 2; idx < arg_count; idx++) {
-            overall_status |= search_file_pattern(target_pattern, arg_values[idx], multiple_sources);
+        // Many files are opened and read ahead through io_uring when available
+        int file_count = arg_count - first_file;
+        FileBatch *batch = (file_count >= BATCH_MIN_FILES) ? file_batch_open(arg_values + first_file, file_count)
+                                                           : NULL;
+        BatchFile file;
+
+        for (int idx = first_file; idx < arg_count; idx++) {
+            int file_status = (batch != NULL && file_batch_next(batch, &file) > 0)
+                              ? search_batch_file(&context, &file)
+                              : search_file_pattern(&context, arg_values[idx]);
+
+            // -q is answered by the first match, even if earlier files failed
+            if (file_status == 0 && report_mode == REPORT_QUIET) {
+                overall_status = 0;
+                break;
+            }
+            overall_status |= file_status;
         }
+        if (batch != NULL) file_batch_close(batch);
     }
 
+    if (output_flush(&output) != 0) {
+        perror("Error writing output");
+        overall_status = 1;
+    }
+    output_release(&output);
+    release_search_pattern(&pattern);
     return overall_status;
 }
 
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "output_buffer.h"
+
+int output_init(OutputBuffer *output, int fd, int line_buffered) {
+    memset(output, 0, sizeof(*output));
+    output->fd = fd;
+    output->line_buffered = line_buffered;
+    output->capacity = (fd >= 0) ? OUTPUT_BUFFER_SIZE : OUTPUT_MEMORY_SIZE;
+    output->data = (char *)malloc(output->capacity);
+    return (output->data != NULL) ? 0 : -1;
+}
+
+static void record_failure(OutputBuffer *output) {
+    output->failed = 1;
+    output->error = errno;
+    output->length = 0;
+}
+
+// Write the buffered bytes followed by extra (which may be empty)
+static void write_through(OutputBuffer *output, const char *extra, size_t extra_length) {
+    struct iovec parts[2] = {{output->data, output->length}, {(void *)extra, extra_length}};
+    struct iovec *part = parts;
+    int remaining = 2;
+
+    while (remaining > 0) {
+        if (part->iov_len == 0) {
+            part++;
+            remaining--;
+            continue;
+        }
+        ssize_t written = writev(output->fd, part, remaining);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            record_failure(output);
+            return;
+        }
+
+        // Skip what a short write did take
+        while (remaining > 0 && (size_t)written >= part->iov_len) {
+            written -= part->iov_len;
+            part++;
+            remaining--;
+        }
+        if (remaining > 0) {
+            part->iov_base = (char *)part->iov_base + written;
+            part->iov_len -= written;
+        }
+    }
+    output->length = 0;
+}
+
+static int grow_memory(OutputBuffer *output, size_t needed) {
+    size_t capacity = output->capacity;
+
+    while (capacity - output->length < needed) capacity *= 2;
+    char *grown = (char *)realloc(output->data, capacity);
+    if (grown == NULL) {
+        errno = ENOMEM;
+        record_failure(output);
+        return -1;
+    }
+    output->data = grown;
+    output->capacity = capacity;
+    return 0;
+}
+
+void output_bytes(OutputBuffer *output, const char *data, size_t length) {
+    if (output->failed) return;
+
+    if (output->capacity - output->length < length) {
+        if (output->fd < 0) {
+            if (grow_memory(output, length) != 0) return;
+        } else if (length >= output->capacity / 2) {
+            // Long enough to be worth a writev() from where it is
+            write_through(output, data, length);
+            return;
+        } else {
+            write_through(output, NULL, 0);
+            if (output->failed) return;
+        }
+    }
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+}
+
+void output_text(OutputBuffer *output, const char *text) {
+    output_bytes(output, text, strlen(text));
+}
+
+void output_number(OutputBuffer *output, unsigned long long number) {
+    char digits[24];
+    size_t start = sizeof(digits);
+
+    do {
+        digits[--start] = (char)('0' + number % 10);
+        number /= 10;
+    } while (number > 0);
+    output_bytes(output, digits + start, sizeof(digits) - start);
+}
+
+void output_line_done(OutputBuffer *output) {
+    if (output->line_buffered && output->fd >= 0 && output->length > 0 && !output->failed) {
+        write_through(output, NULL, 0);
+    }
+}
+
+int output_flush(OutputBuffer *output) {
+    if (output->fd >= 0 && output->length > 0 && !output->failed) write_through(output, NULL, 0);
+    if (output->failed) {
+        errno = output->error;
+        return -1;
+    }
+    return 0;
+}
+
+void output_release(OutputBuffer *output) {
+    free(output->data);
+    output->data = NULL;
+    output->length = 0;
+    output->capacity = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_MEMORY_SIZE 4096     // first allocation of a memory buffer
+
+// Collects output in one large buffer and hands it to write() directly,
+// without stdio's locking and format parsing per line. Data that does
+// not fit is written together with the buffered bytes by one writev().
+// A buffer without a descriptor (fd -1) only grows in memory; its owner
+// moves the contents on with output_bytes() on another buffer.
+typedef struct {
+    int fd;
+    int line_buffered;      // flush at the end of every line
+    int failed;             // a write failed; later output is dropped
+    int error;              // errno of that failure
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+// Returns 0, or -1 if the buffer could not be allocated.
+int output_init(OutputBuffer *output, int fd, int line_buffered);
+
+void output_bytes(OutputBuffer *output, const char *data, size_t length);
+
+void output_text(OutputBuffer *output, const char *text);
+
+// Decimal, without any padding.
+void output_number(OutputBuffer *output, unsigned long long number);
+
+// Marks the end of an output line: a line-buffered output flushes here.
+void output_line_done(OutputBuffer *output);
+
+// Returns 0, or -1 with errno set if any write failed.
+int output_flush(OutputBuffer *output);
+
+void output_release(OutputBuffer *output);
+
+#endif
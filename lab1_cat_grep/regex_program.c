@@ -0,0 +1,753 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "regex_program.h"
+
+#define AST_SET 1
+#define AST_LINE_START 2
+#define AST_LINE_END 3
+#define AST_CONCAT 4
+#define AST_ALTERNATION 5
+#define AST_REPEAT 6
+#define AST_OPAQUE 7        // something only regexec handles; literal extraction only
+
+#define UNBOUNDED -1
+#define MAX_GROUP_DEPTH 256
+#define MAX_STACKED_QUANTIFIERS 8
+#define MAX_REPEAT_COUNT 1000           // larger counts are left to regexec
+#define MAX_PROGRAM_NODES (1 << 20)
+#define MAX_REQUIRED_LITERAL 64
+
+typedef struct {
+    int type;
+    uint32_t set;
+    int child;          // first child; siblings are linked last first
+    int sibling;
+    int min_count;      // AST_REPEAT
+    int max_count;
+} AstNode;
+
+typedef struct {
+    const char *cursor;
+    AstNode *ast;
+    size_t ast_count;
+    size_t ast_capacity;
+    uint64_t (*sets)[4];
+    size_t set_count;
+    size_t set_capacity;
+    uint32_t *set_slots;    // open addressing over sets, index + 1 (0 = empty)
+    size_t set_slot_count;
+    int depth;
+    int allow_opaque;       // parse back-references and word boundaries as AST_OPAQUE
+} RegexParser;
+
+// What a subexpression says about the strings it matches. Any of these
+// may be weaker than the truth (shorter or empty), never wrong.
+typedef struct {
+    int exact;              // it matches exactly the string in text
+    size_t exact_len;
+    size_t prefix_len;      // every match starts with prefix
+    size_t suffix_len;      // every match ends with suffix
+    size_t required_len;    // every match contains required
+    char text[MAX_REQUIRED_LITERAL];
+    char prefix[MAX_REQUIRED_LITERAL];
+    char suffix[MAX_REQUIRED_LITERAL];
+    char required[MAX_REQUIRED_LITERAL];
+} LiteralFacts;
+
+typedef struct {
+    RegexProgram *program;
+    size_t node_capacity;
+    const AstNode *ast;
+} ProgramBuilder;
+
+static const struct {
+    const char *name;
+    int (*contains)(int);
+} named_classes[] = {
+    {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+    {"lower", islower}, {"space", isspace}, {"blank", isblank}, {"punct", ispunct},
+    {"print", isprint}, {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+};
+
+static void set_byte(uint64_t bits[4], unsigned char byte) {
+    bits[byte >> 6] |= 1ULL << (byte & 63);
+}
+
+static void clear_byte(uint64_t bits[4], unsigned char byte) {
+    bits[byte >> 6] &= ~(1ULL << (byte & 63));
+}
+
+// No locale is set, so the classes are those of the C locale
+static int add_named_class(uint64_t bits[4], const char *name, size_t length) {
+    for (size_t i = 0; i < sizeof(named_classes) / sizeof(named_classes[0]); i++) {
+        if (strlen(named_classes[i].name) != length || memcmp(named_classes[i].name, name, length) != 0) {
+            continue;
+        }
+        for (int byte = 0; byte < 256; byte++) {
+            if (named_classes[i].contains(byte)) set_byte(bits, (unsigned char)byte);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t hash_set(const uint64_t bits[4]) {
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a over the words
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ bits[i]) * 1099511628211ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static int grow_set_slots(RegexParser *parser) {
+    size_t slot_count = parser->set_slot_count ? parser->set_slot_count * 2 : 64;
+    uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL) return -1;
+
+    for (size_t i = 0; i < parser->set_count; i++) {
+        size_t slot = hash_set(parser->sets[i]) & (slot_count - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (uint32_t)i + 1;
+    }
+
+    free(parser->set_slots);
+    parser->set_slots = slots;
+    parser->set_slot_count = slot_count;
+    return 0;
+}
+
+// Identical sets share an index, which keeps the byte class computation cheap
+static long intern_set(RegexParser *parser, const uint64_t bits[4]) {
+    if ((parser->set_count + 1) * 2 > parser->set_slot_count && grow_set_slots(parser) != 0) return -1;
+
+    size_t slot = hash_set(bits) & (parser->set_slot_count - 1);
+    for (; parser->set_slots[slot] != 0; slot = (slot + 1) & (parser->set_slot_count - 1)) {
+        uint32_t index = parser->set_slots[slot] - 1;
+        if (memcmp(parser->sets[index], bits, sizeof(parser->sets[index])) == 0) return index;
+    }
+
+    if (parser->set_count == parser->set_capacity) {
+        size_t capacity = parser->set_capacity ? parser->set_capacity * 2 : 16;
+        uint64_t (*grown)[4] = realloc(parser->sets, capacity * sizeof(*grown));
+        if (grown == NULL) return -1;
+        parser->sets = grown;
+        parser->set_capacity = capacity;
+    }
+
+    memcpy(parser->sets[parser->set_count], bits, sizeof(parser->sets[0]));
+    parser->set_slots[slot] = (uint32_t)parser->set_count + 1;
+    return (long)parser->set_count++;
+}
+
+static int new_ast_node(RegexParser *parser, int type) {
+    if (parser->ast_count == parser->ast_capacity) {
+        size_t capacity = parser->ast_capacity ? parser->ast_capacity * 2 : 64;
+        AstNode *grown = (AstNode *)realloc(parser->ast, capacity * sizeof(AstNode));
+        if (grown == NULL) return -1;
+        parser->ast = grown;
+        parser->ast_capacity = capacity;
+    }
+
+    AstNode *node = &parser->ast[parser->ast_count];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->child = -1;
+    node->sibling = -1;
+    return (int)parser->ast_count++;
+}
+
+static int new_set_node(RegexParser *parser, const uint64_t bits[4]) {
+    long set = intern_set(parser, bits);
+    if (set < 0) return -1;
+
+    int node = new_ast_node(parser, AST_SET);
+    if (node >= 0) parser->ast[node].set = (uint32_t)set;
+    return node;
+}
+
+static void prepend_child(RegexParser *parser, int parent, int child) {
+    parser->ast[child].sibling = parser->ast[parent].child;
+    parser->ast[parent].child = child;
+}
+
+// Bracket expression after the '['; equivalence classes and collating
+// elements are not supported
+static int parse_bracket(RegexParser *parser, uint64_t bits[4]) {
+    const char *cursor = parser->cursor;
+    int negate = 0;
+    int first = 1;
+
+    if (*cursor == '^') {
+        negate = 1;
+        cursor++;
+    }
+
+    while (first || *cursor != ']') {
+        if (*cursor == '\0') return -1;
+        if (cursor[0] == '[' && (cursor[1] == '=' || cursor[1] == '.')) return -1;
+
+        first = 0;
+        if (cursor[0] == '[' && cursor[1] == ':') {
+            const char *name_end = strstr(cursor + 2, ":]");
+            if (name_end == NULL || !add_named_class(bits, cursor + 2, name_end - cursor - 2)) return -1;
+            cursor = name_end + 2;
+            if (cursor[0] == '-' && cursor[1] != ']') return -1;
+            continue;
+        }
+
+        int low = (unsigned char)*cursor++;
+        int high = low;
+        if (cursor[0] == '-' && cursor[1] != ']' && cursor[1] != '\0') {
+            if (cursor[1] == '[') return -1;
+            high = (unsigned char)cursor[1];
+            cursor += 2;
+            if (high < low) return -1;
+        }
+        for (int byte = low; byte <= high; byte++) {
+            set_byte(bits, (unsigned char)byte);
+        }
+    }
+
+    if (negate) {
+        for (int i = 0; i < 4; i++) bits[i] = ~bits[i];
+        clear_byte(bits, '\n');  // REG_NEWLINE: a non-matching list never matches a newline
+    }
+
+    parser->cursor = cursor + 1;
+    return 0;
+}
+
+// Back-references and the GNU word-boundary operators make the pattern unsupported
+static int parse_escape(RegexParser *parser, uint64_t bits[4]) {
+    unsigned char escaped = (unsigned char)parser->cursor[1];
+    int negate = 0;
+
+    switch (escaped) {
+        case '\0':
+        case 'b': case 'B': case '<': case '>': case '`': case '\'':
+            return -1;
+        case 'W':
+            negate = 1;
+            // fall through
+        case 'w':
+            add_named_class(bits, "alnum", 5);
+            set_byte(bits, '_');
+            break;
+        case 'S':
+            negate = 1;
+            // fall through
+        case 's':
+            add_named_class(bits, "space", 5);
+            break;
+        default:
+            if (isdigit(escaped)) return -1;
+            set_byte(bits, escaped);
+            break;
+    }
+
+    if (negate) {
+        for (int i = 0; i < 4; i++) bits[i] = ~bits[i];
+        clear_byte(bits, '\n');
+    }
+
+    parser->cursor += 2;
+    return 0;
+}
+
+// {n}, {n,}, {,m} or {n,m} after the '{'
+static int parse_interval(RegexParser *parser, int *min_count, int *max_count) {
+    const char *cursor = parser->cursor + 1;
+    int low = 0;
+    int high;
+
+    if (!isdigit((unsigned char)*cursor) && *cursor != ',') return -1;
+    for (; isdigit((unsigned char)*cursor); cursor++) {
+        low = low * 10 + (*cursor - '0');
+        if (low > MAX_REPEAT_COUNT) return -1;
+    }
+
+    high = low;
+    if (*cursor == ',') {
+        cursor++;
+        high = UNBOUNDED;
+        if (isdigit((unsigned char)*cursor)) high = 0;
+        for (; isdigit((unsigned char)*cursor); cursor++) {
+            high = high * 10 + (*cursor - '0');
+            if (high > MAX_REPEAT_COUNT) return -1;
+        }
+    }
+
+    if (*cursor != '}' || (high != UNBOUNDED && high < low)) return -1;
+
+    parser->cursor = cursor + 1;
+    *min_count = low;
+    *max_count = high;
+    return 0;
+}
+
+static int parse_alternation(RegexParser *parser);
+
+static int parse_atom(RegexParser *parser) {
+    uint64_t bits[4] = {0, 0, 0, 0};
+    int node;
+
+    switch (*parser->cursor) {
+        case '(':
+            if (++parser->depth > MAX_GROUP_DEPTH) return -1;
+            parser->cursor++;
+            node = parse_alternation(parser);
+            if (node < 0 || *parser->cursor != ')') return -1;
+            parser->cursor++;
+            parser->depth--;
+            return node;
+        case '.':
+            for (int i = 0; i < 4; i++) bits[i] = ~0ULL;
+            clear_byte(bits, '\n');
+            clear_byte(bits, '\0');  // RE_DOT_NOT_NULL
+            parser->cursor++;
+            return new_set_node(parser, bits);
+        case '^':
+            parser->cursor++;
+            return new_ast_node(parser, AST_LINE_START);
+        case '$':
+            parser->cursor++;
+            return new_ast_node(parser, AST_LINE_END);
+        case '[':
+            parser->cursor++;
+            if (parse_bracket(parser, bits) != 0) return -1;
+            return new_set_node(parser, bits);
+        case '\\':
+            if (parse_escape(parser, bits) == 0) return new_set_node(parser, bits);
+            if (!parser->allow_opaque || parser->cursor[1] == '\0') return -1;
+            parser->cursor += 2;
+            return new_ast_node(parser, AST_OPAQUE);
+        case '*': case '+': case '?': case '{':
+            return -1;
+        default:
+            // Includes an unmatched ')', which regcomp takes literally
+            set_byte(bits, (unsigned char)*parser->cursor++);
+            return new_set_node(parser, bits);
+    }
+}
+
+static int parse_piece(RegexParser *parser) {
+    int atom = parse_atom(parser);
+    int stacked = 0;
+
+    while (atom >= 0 && *parser->cursor != '\0' && strchr("*+?{", *parser->cursor) != NULL) {
+        int min_count = 0;
+        int max_count = UNBOUNDED;
+        int type = parser->ast[atom].type;
+
+        // Repeating an anchor means something different to regcomp
+        if (type == AST_LINE_START || type == AST_LINE_END || ++stacked > MAX_STACKED_QUANTIFIERS) return -1;
+
+        switch (*parser->cursor) {
+            case '*':
+                parser->cursor++;
+                break;
+            case '+':
+                min_count = 1;
+                parser->cursor++;
+                break;
+            case '?':
+                max_count = 1;
+                parser->cursor++;
+                break;
+            default:
+                if (parse_interval(parser, &min_count, &max_count) != 0) return -1;
+                break;
+        }
+
+        int repeat = new_ast_node(parser, AST_REPEAT);
+        if (repeat < 0) return -1;
+        parser->ast[repeat].child = atom;
+        parser->ast[repeat].min_count = min_count;
+        parser->ast[repeat].max_count = max_count;
+        atom = repeat;
+    }
+    return atom;
+}
+
+static int parse_branch(RegexParser *parser) {
+    int branch = new_ast_node(parser, AST_CONCAT);
+
+    while (branch >= 0 && *parser->cursor != '\0' && *parser->cursor != '|' &&
+           !(*parser->cursor == ')' && parser->depth > 0)) {
+        int piece = parse_piece(parser);
+        if (piece < 0) return -1;
+        prepend_child(parser, branch, piece);
+    }
+    return branch;
+}
+
+static int parse_alternation(RegexParser *parser) {
+    int alternation = new_ast_node(parser, AST_ALTERNATION);
+
+    while (alternation >= 0) {
+        int branch = parse_branch(parser);
+        if (branch < 0) return -1;
+        prepend_child(parser, alternation, branch);
+
+        if (*parser->cursor != '|') break;
+        parser->cursor++;
+    }
+    return alternation;
+}
+
+static long add_program_node(ProgramBuilder *builder, int type, long out, long alt) {
+    RegexProgram *program = builder->program;
+
+    if (program->node_count == builder->node_capacity) {
+        size_t capacity = builder->node_capacity ? builder->node_capacity * 2 : 64;
+        if (capacity > MAX_PROGRAM_NODES) return -1;
+        RegexNode *grown = (RegexNode *)realloc(program->nodes, capacity * sizeof(RegexNode));
+        if (grown == NULL) return -1;
+        program->nodes = grown;
+        builder->node_capacity = capacity;
+    }
+
+    RegexNode *node = &program->nodes[program->node_count];
+    node->type = (uint8_t)type;
+    node->out = (uint32_t)out;
+    node->alt = (uint32_t)alt;
+    return (long)program->node_count++;
+}
+
+static long compile_ast(ProgramBuilder *builder, int index, long next);
+
+// Mandatory copies first, then either a loop or a chain of optional copies
+static long compile_repeat(ProgramBuilder *builder, const AstNode *node, long next) {
+    long entry = next;
+
+    if (node->max_count == UNBOUNDED) {
+        long loop = add_program_node(builder, REGEX_NODE_SPLIT, 0, next);
+        long body = (loop >= 0) ? compile_ast(builder, node->child, loop) : -1;
+        if (body < 0) return -1;
+        builder->program->nodes[loop].out = (uint32_t)body;
+        entry = loop;
+    } else {
+        for (int i = node->min_count; i < node->max_count && entry >= 0; i++) {
+            long body = compile_ast(builder, node->child, entry);
+            entry = (body >= 0) ? add_program_node(builder, REGEX_NODE_SPLIT, body, next) : -1;
+        }
+    }
+
+    for (int i = 0; i < node->min_count && entry >= 0; i++) {
+        entry = compile_ast(builder, node->child, entry);
+    }
+    return entry;
+}
+
+// Compile a node whose continuation has already been compiled, so that no
+// dangling edges ever need patching
+static long compile_ast(ProgramBuilder *builder, int index, long next) {
+    const AstNode *node = &builder->ast[index];
+    long entry = next;
+
+    switch (node->type) {
+        case AST_SET:
+            return add_program_node(builder, REGEX_NODE_SET, next, node->set);
+        case AST_LINE_START:
+            return add_program_node(builder, REGEX_NODE_LINE_START, next, 0);
+        case AST_LINE_END:
+            return add_program_node(builder, REGEX_NODE_LINE_END, next, 0);
+        case AST_CONCAT:
+            // Children are linked last first, which is the order they compile in
+            for (int child = node->child; child >= 0 && entry >= 0; child = builder->ast[child].sibling) {
+                entry = compile_ast(builder, child, entry);
+            }
+            return entry;
+        case AST_ALTERNATION:
+            entry = -1;
+            for (int child = node->child; child >= 0; child = builder->ast[child].sibling) {
+                long branch = compile_ast(builder, child, next);
+                if (branch < 0) return -1;
+                entry = (entry < 0) ? branch : add_program_node(builder, REGEX_NODE_SPLIT, branch, entry);
+                if (entry < 0) return -1;
+            }
+            return entry;
+        case AST_REPEAT:
+            return compile_repeat(builder, node, next);
+    }
+    return -1;
+}
+
+// Bytes that are members of exactly the same sets behave identically;
+// splitting at every set edge gives such classes as contiguous byte ranges.
+// The newline always gets a class of its own since it ends a line.
+static void assign_byte_classes(RegexProgram *program) {
+    unsigned char boundary[256] = {0};
+    size_t class_index = 0;
+
+    boundary['\n' - 1] = 1;
+    boundary['\n'] = 1;
+
+    for (size_t set = 0; set < program->set_count; set++) {
+        for (int byte = 0; byte < 255; byte++) {
+            if (regex_set_contains(program, set, byte) != regex_set_contains(program, set, byte + 1)) {
+                boundary[byte] = 1;
+            }
+        }
+    }
+
+    program->class_byte[0] = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        program->byte_class[byte] = (unsigned char)class_index;
+        if (boundary[byte] && byte < 255) {
+            class_index++;
+            program->class_byte[class_index] = (unsigned char)(byte + 1);
+        }
+    }
+    program->class_count = class_index + 1;
+}
+
+static int parse_pattern(RegexParser *parser, const char *search_pattern, int allow_opaque) {
+    int root;
+
+    memset(parser, 0, sizeof(*parser));
+    parser->cursor = search_pattern;
+    parser->allow_opaque = allow_opaque;
+
+    root = parse_alternation(parser);
+    return (root >= 0 && *parser->cursor == '\0') ? root : -1;
+}
+
+RegexProgram *regex_program_compile(const char *search_pattern) {
+    RegexParser parser;
+    ProgramBuilder builder;
+    RegexProgram *program;
+    int root;
+    long match = -1;
+    long start = -1;
+
+    // A newline in the pattern could match across lines
+    if (strchr(search_pattern, '\n') != NULL) return NULL;
+
+    root = parse_pattern(&parser, search_pattern, 0);
+
+    program = (root >= 0) ? (RegexProgram *)calloc(1, sizeof(RegexProgram)) : NULL;
+    if (program != NULL) {
+        builder.program = program;
+        builder.node_capacity = 0;
+        builder.ast = parser.ast;
+        match = add_program_node(&builder, REGEX_NODE_MATCH, 0, 0);
+        start = (match >= 0) ? compile_ast(&builder, root, match) : -1;
+    }
+
+    free(parser.ast);
+    free(parser.set_slots);
+
+    if (start < 0) {
+        free(parser.sets);
+        if (program != NULL) regex_program_free(program);
+        return NULL;
+    }
+
+    program->start = (uint32_t)start;
+    program->sets = parser.sets;
+    program->set_count = parser.set_count;
+    assign_byte_classes(program);
+    return program;
+}
+
+void regex_program_free(RegexProgram *program) {
+    if (program == NULL) return;
+    free(program->nodes);
+    free(program->sets);
+    free(program);
+}
+
+static void copy_bounded(char *target, size_t *target_len, const char *source, size_t length) {
+    if (length > MAX_REQUIRED_LITERAL) length = MAX_REQUIRED_LITERAL;
+    memmove(target, source, length);
+    *target_len = length;
+}
+
+// left followed by right; the result replaces right
+static void concatenate_facts(const LiteralFacts *left, LiteralFacts *right) {
+    char joined[2 * MAX_REQUIRED_LITERAL];
+    size_t joined_len;
+    LiteralFacts result;
+
+    memset(&result, 0, sizeof(result));
+
+    // Truncation keeps each fact true: the front of a prefix, the back of
+    // a suffix, any part of a required string
+    memcpy(joined, left->exact ? left->text : left->prefix, left->exact ? left->exact_len : left->prefix_len);
+    joined_len = left->exact ? left->exact_len : left->prefix_len;
+    if (left->exact) {
+        memcpy(joined + joined_len, right->prefix, right->prefix_len);
+        joined_len += right->prefix_len;
+    }
+    copy_bounded(result.prefix, &result.prefix_len, joined, joined_len);
+
+    memcpy(joined, left->suffix, left->suffix_len);
+    joined_len = left->suffix_len;
+    if (right->exact) {
+        memcpy(joined + joined_len, right->text, right->exact_len);
+        joined_len += right->exact_len;
+        if (joined_len > MAX_REQUIRED_LITERAL) {
+            memmove(joined, joined + joined_len - MAX_REQUIRED_LITERAL, MAX_REQUIRED_LITERAL);
+            joined_len = MAX_REQUIRED_LITERAL;
+        }
+    } else {
+        memcpy(joined, right->suffix, right->suffix_len);
+        joined_len = right->suffix_len;
+    }
+    copy_bounded(result.suffix, &result.suffix_len, joined, joined_len);
+
+    if (left->exact && right->exact && left->exact_len + right->exact_len <= MAX_REQUIRED_LITERAL) {
+        result.exact = 1;
+        memcpy(result.text, left->text, left->exact_len);
+        memcpy(result.text + left->exact_len, right->text, right->exact_len);
+        result.exact_len = left->exact_len + right->exact_len;
+    }
+
+    // The longest of: either side's own, or the seam between them
+    memcpy(joined, left->suffix, left->suffix_len);
+    memcpy(joined + left->suffix_len, right->prefix, right->prefix_len);
+    copy_bounded(result.required, &result.required_len, joined, left->suffix_len + right->prefix_len);
+    if (left->required_len > result.required_len) {
+        copy_bounded(result.required, &result.required_len, left->required, left->required_len);
+    }
+    if (right->required_len > result.required_len) {
+        copy_bounded(result.required, &result.required_len, right->required, right->required_len);
+    }
+
+    *right = result;
+}
+
+static void set_exact_facts(LiteralFacts *facts, const char *text, size_t length) {
+    memset(facts, 0, sizeof(*facts));
+    facts->exact = 1;
+    copy_bounded(facts->text, &facts->exact_len, text, length);
+    copy_bounded(facts->prefix, &facts->prefix_len, text, length);
+    copy_bounded(facts->suffix, &facts->suffix_len, text, length);
+    copy_bounded(facts->required, &facts->required_len, text, length);
+}
+
+static void collect_facts(const RegexParser *parser, int index, LiteralFacts *facts);
+
+// Only what all branches share survives an alternation
+static void alternation_facts(const RegexParser *parser, const AstNode *node, LiteralFacts *facts) {
+    LiteralFacts branch;
+    int first = 1;
+
+    memset(facts, 0, sizeof(*facts));
+    for (int child = node->child; child >= 0; child = parser->ast[child].sibling) {
+        collect_facts(parser, child, &branch);
+        if (first) {
+            *facts = branch;
+            first = 0;
+            continue;
+        }
+
+        if (!branch.exact || !facts->exact || branch.exact_len != facts->exact_len ||
+            memcmp(branch.text, facts->text, branch.exact_len) != 0) {
+            facts->exact = 0;
+        }
+
+        size_t common = 0;
+        while (common < facts->prefix_len && common < branch.prefix_len &&
+               facts->prefix[common] == branch.prefix[common]) {
+            common++;
+        }
+        facts->prefix_len = common;
+
+        common = 0;
+        while (common < facts->suffix_len && common < branch.suffix_len &&
+               facts->suffix[facts->suffix_len - 1 - common] == branch.suffix[branch.suffix_len - 1 - common]) {
+            common++;
+        }
+        memmove(facts->suffix, facts->suffix + facts->suffix_len - common, common);
+        facts->suffix_len = common;
+
+        if (branch.required_len != facts->required_len ||
+            memcmp(branch.required, facts->required, branch.required_len) != 0) {
+            facts->required_len = 0;
+        }
+    }
+
+    if (facts->exact) return;
+    if (facts->prefix_len > facts->required_len) {
+        copy_bounded(facts->required, &facts->required_len, facts->prefix, facts->prefix_len);
+    }
+    if (facts->suffix_len > facts->required_len) {
+        copy_bounded(facts->required, &facts->required_len, facts->suffix, facts->suffix_len);
+    }
+}
+
+static void collect_facts(const RegexParser *parser, int index, LiteralFacts *facts) {
+    const AstNode *node = &parser->ast[index];
+    LiteralFacts element;
+
+    memset(facts, 0, sizeof(*facts));
+    switch (node->type) {
+        case AST_SET: {
+            int members = 0;
+            char member = 0;
+            for (int byte = 0; byte < 256 && members < 2; byte++) {
+                if ((parser->sets[node->set][byte >> 6] >> (byte & 63)) & 1) {
+                    members++;
+                    member = (char)byte;
+                }
+            }
+            if (members == 1) set_exact_facts(facts, &member, 1);
+            break;
+        }
+        case AST_LINE_START:
+        case AST_LINE_END:
+            set_exact_facts(facts, "", 0);
+            break;
+        case AST_CONCAT:
+            // Children are linked last first, so fold from the right
+            set_exact_facts(facts, "", 0);
+            for (int child = node->child; child >= 0; child = parser->ast[child].sibling) {
+                collect_facts(parser, child, &element);
+                concatenate_facts(&element, facts);
+            }
+            break;
+        case AST_ALTERNATION:
+            alternation_facts(parser, node, facts);
+            break;
+        case AST_REPEAT:
+            if (node->min_count == 0) break;
+            collect_facts(parser, node->child, facts);
+            if (node->min_count != node->max_count || !facts->exact) {
+                facts->exact = 0;
+                break;
+            }
+            element = *facts;
+            for (int i = 1; i < node->min_count; i++) {
+                concatenate_facts(&element, facts);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+int regex_required_literal(const char *search_pattern, char **literal, size_t *length) {
+    RegexParser parser;
+    LiteralFacts facts;
+    int root = parse_pattern(&parser, search_pattern, 1);
+
+    *literal = NULL;
+    *length = 0;
+    if (root >= 0) {
+        collect_facts(&parser, root, &facts);
+        if (facts.required_len > 0) *literal = (char *)malloc(facts.required_len + 1);
+        if (*literal != NULL) {
+            memcpy(*literal, facts.required, facts.required_len);
+            (*literal)[facts.required_len] = '\0';
+            *length = facts.required_len;
+        }
+    }
+
+    free(parser.ast);
+    free(parser.sets);
+    free(parser.set_slots);
+    return (*literal != NULL) ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef REGEX_PROGRAM_H
+#define REGEX_PROGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REGEX_NODE_SET 1          // consume one byte of a set, then go to out
+#define REGEX_NODE_SPLIT 2        // continue at both out and alt
+#define REGEX_NODE_LINE_START 3   // '^': only at the start of a line
+#define REGEX_NODE_LINE_END 4     // '$': only at the end of a line
+#define REGEX_NODE_MATCH 5
+
+typedef struct {
+    uint8_t type;
+    uint32_t out;
+    uint32_t alt;                 // REGEX_NODE_SPLIT: second successor; REGEX_NODE_SET: set index
+} RegexNode;
+
+// A POSIX extended regex compiled to a Thompson NFA over bytes, with the
+// semantics regcomp(REG_EXTENDED | REG_NEWLINE) gives it in the C locale.
+// Byte sets are deduplicated and bytes that no set tells apart share one
+// class (the newline always has its own), so automata built on top only
+// need a column per class.
+typedef struct {
+    RegexNode *nodes;
+    size_t node_count;
+    uint32_t start;
+    uint64_t (*sets)[4];          // 256-bit membership bitmaps
+    size_t set_count;
+    unsigned char byte_class[256];
+    unsigned char class_byte[256];  // one representative byte per class
+    size_t class_count;
+} RegexProgram;
+
+// Returns NULL when the pattern uses something only regexec supports
+// (back-references, word boundaries, collating elements, ...) or when
+// memory runs out; the caller then keeps using regexec.
+RegexProgram *regex_program_compile(const char *search_pattern);
+
+void regex_program_free(RegexProgram *program);
+
+// Longest string (up to 64 bytes) that every match must contain, so that
+// only lines containing it need the full regex. Also works for patterns
+// regex_program_compile rejects. Returns -1 if there is none; otherwise
+// *literal is malloc'd.
+int regex_required_literal(const char *search_pattern, char **literal, size_t *length);
+
+static inline int regex_set_contains(const RegexProgram *program, uint32_t set, unsigned char byte) {
+    return (program->sets[set][byte >> 6] >> (byte & 63)) & 1;
+}
+
+#endif
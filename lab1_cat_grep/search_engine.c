@@ -0,0 +1,411 @@
+#define _GNU_SOURCE  // for memrchr(), REG_STARTEND
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "search_engine.h"
+#include "literal_search.h"
+#include "block_reader.h"
+#include "context_lines.h"
+
+#define PREFILTER_PROBE_LINES 16
+#define PREFILTER_MIN_SPACING 512  // bytes per rejected candidate line
+
+typedef struct {
+    unsigned long long line_number;   // number of the line starting at counted_upto
+    const char *counted_upto;
+} LineTracker;
+
+static void print_prefixed_line(const SearchContext *context, TextSpan line, unsigned long long line_number,
+                                const char *separator) {
+    if (context->multi_source && context->source_name != NULL) {
+        output_text(context->output, context->source_name);
+        output_bytes(context->output, separator, 1);
+    }
+    if (context->line_numbers) {
+        output_number(context->output, line_number);
+        output_bytes(context->output, separator, 1);
+    }
+    output_bytes(context->output, line.data, line.length);
+    output_line_done(context->output);
+}
+
+void print_search_line(const SearchContext *context, TextSpan line, unsigned long long line_number) {
+    print_prefixed_line(context, line, line_number, ":");
+}
+
+void print_context_line(const SearchContext *context, TextSpan line, unsigned long long line_number) {
+    print_prefixed_line(context, line, line_number, "-");
+}
+
+void print_context_separator(const SearchContext *context) {
+    if (*context->printed_groups) {
+        output_bytes(context->output, "--\n", 3);
+        output_line_done(context->output);
+    }
+    *context->printed_groups = 1;
+}
+
+void print_collected_output(const SearchContext *context, OutputBuffer *collected, int collected_groups) {
+    if (collected->length == 0) return;
+
+    // The collected output was written as if it came first
+    if (collected_groups && *context->printed_groups) output_bytes(context->output, "--\n", 3);
+    *context->printed_groups |= collected_groups;
+    output_bytes(context->output, collected->data, collected->length);
+    output_line_done(context->output);
+}
+
+void print_search_summary(const SearchContext *context, unsigned long long match_count, int binary) {
+    const char *name = (context->source_name != NULL) ? context->source_name : "(standard input)";
+
+    switch (context->report_mode) {
+        case REPORT_COUNT:
+            if (context->multi_source && context->source_name != NULL) {
+                output_text(context->output, context->source_name);
+                output_bytes(context->output, ":", 1);
+            }
+            output_number(context->output, match_count);
+            break;
+        case REPORT_FILES:
+            if (match_count == 0) return;
+            output_text(context->output, name);
+            break;
+        case REPORT_LINES:
+            if (!binary || match_count == 0) return;
+            output_text(context->output, "Binary file ");
+            output_text(context->output, name);
+            output_text(context->output, " matches");
+            break;
+        default:
+            return;
+    }
+    output_bytes(context->output, "\n", 1);
+    output_line_done(context->output);
+}
+
+// Newlines are only counted up to matching lines, and only with -n
+static void report_match(const SearchContext *context, LineTracker *tracker, TextSpan line) {
+    if (context->line_numbers) {
+        tracker->line_number += count_newlines(tracker->counted_upto, line.data - tracker->counted_upto);
+        tracker->counted_upto = line.data;
+    }
+
+    if (context->match_handler != NULL) {
+        context->match_handler(context->handler_arg, line, tracker->line_number);
+    } else {
+        print_search_line(context, line, tracker->line_number);
+    }
+}
+
+// Each matcher finds the next position in [from, end) that lies inside a
+// matching line; from is always the start of a line.
+
+static const char *find_literal_match(const PatternAnalysis *analysis, const char *from, const char *end) {
+    const char *cursor = from;
+    const char *line_floor = from;  // cursor may point into a line, this never does
+
+    while (cursor < end) {
+        const char *hit = find_literal(cursor, end - cursor, analysis->literal, analysis->literal_len);
+        if (hit == NULL || !(analysis->flags & (PATTERN_ANCHORED_START | PATTERN_ANCHORED_END))) {
+            return hit;
+        }
+
+        const char *line_start = memrchr(line_floor, '\n', hit - line_floor);
+        line_start = (line_start != NULL) ? line_start + 1 : line_floor;
+
+        // Anchored literals: a hit elsewhere in the line is not a match
+        const char *hit_end = hit + analysis->literal_len;
+        int misses_start = (analysis->flags & PATTERN_ANCHORED_START) && hit != line_start;
+        int misses_end = (analysis->flags & PATTERN_ANCHORED_END) && hit_end != end && *hit_end != '\n';
+
+        if (misses_start || (misses_end && (analysis->flags & PATTERN_ANCHORED_START))) {
+            const char *line_end = memchr(hit, '\n', end - hit);
+            if (line_end == NULL) return NULL;
+            cursor = line_floor = line_end + 1;
+        } else if (misses_end) {
+            cursor = hit + 1;
+            line_floor = line_start;
+        } else {
+            return hit;
+        }
+    }
+
+    return NULL;
+}
+
+static const char *run_regex(const PatternMatcher *matcher, const char *from, const char *end) {
+    regmatch_t match;
+
+    if (matcher->dfa != NULL) return lazy_dfa_find(matcher->dfa, from, end - from);
+
+    match.rm_so = 0;
+    match.rm_eo = end - from;
+    if (regexec(&matcher->regex, from, 1, &match, REG_STARTEND) != 0) return NULL;
+
+    // An empty match past the final newline is not a line of its own
+    const char *hit = from + match.rm_so;
+    if (hit == end && end[-1] == '\n') return NULL;
+    return hit;
+}
+
+// Only lines containing the required literal are handed to the regex.
+// When candidates turn out to be dense the prefilter costs more than it
+// saves, so the rest of the range goes straight to the regex.
+static const char *find_regex_match(const PatternMatcher *matcher, const char *from, const char *end) {
+    const char *range_start = from;
+    size_t candidates = 0;
+
+    if (matcher->required_literal == NULL) return run_regex(matcher, from, end);
+
+    while (from < end) {
+        if (candidates >= PREFILTER_PROBE_LINES &&
+            (size_t)(from - range_start) < candidates * PREFILTER_MIN_SPACING) {
+            return run_regex(matcher, from, end);
+        }
+
+        const char *literal = find_literal(from, end - from, matcher->required_literal, matcher->required_len);
+        if (literal == NULL) return NULL;
+
+        const char *line_start = memrchr(from, '\n', literal - from);
+        line_start = (line_start != NULL) ? line_start + 1 : from;
+        const char *line_end = memchr(literal, '\n', end - literal);
+        line_end = (line_end != NULL) ? line_end + 1 : end;
+
+        const char *hit = run_regex(matcher, line_start, line_end);
+        if (hit != NULL) return hit;
+
+        candidates++;
+        from = line_end;
+    }
+    return NULL;
+}
+
+static const char *find_matcher_hit(const PatternMatcher *matcher, const char *from, const char *end) {
+    switch (matcher->kind) {
+        case MATCHER_LITERAL:
+            return find_literal_match(&matcher->analysis, from, end);
+        case MATCHER_LITERAL_SET:
+            return aho_corasick_find(matcher->automaton, from, end - from);
+        case MATCHER_REGEX:
+            return find_regex_match(matcher, from, end);
+    }
+    return NULL;
+}
+
+// Scan a block of complete lines, locating line boundaries only around hits.
+// With several matchers the earliest hit wins; a matcher is only asked
+// again once the scan has moved past its previous hit.
+static int scan_block(const SearchContext *context, LineTracker *tracker, TextSpan block) {
+    const SearchPattern *pattern = context->pattern;
+    const char *cursor = block.data;
+    const char *block_end = span_end(block);
+    const char *single_hit;
+    const char **next_hits = &single_hit;
+    int found_status = 0;
+
+    if (pattern->matcher_count == 0 || block.length == 0) return 0;
+    if (pattern->matcher_count > 1) {
+        next_hits = (const char **)malloc(pattern->matcher_count * sizeof(const char *));
+        if (next_hits == NULL) return 0;
+    }
+
+    for (size_t i = 0; i < pattern->matcher_count; i++) {
+        next_hits[i] = find_matcher_hit(&pattern->matchers[i], cursor, block_end);
+    }
+
+    for (;;) {
+        const char *hit = NULL;
+        for (size_t i = 0; i < pattern->matcher_count; i++) {
+            if (next_hits[i] != NULL && (hit == NULL || next_hits[i] < hit)) hit = next_hits[i];
+        }
+        if (hit == NULL) break;
+
+        const char *line_start = memrchr(cursor, '\n', hit - cursor);
+        line_start = (line_start != NULL) ? line_start + 1 : cursor;
+        const char *line_end = memchr(hit, '\n', block_end - hit);
+        line_end = (line_end != NULL) ? line_end + 1 : block_end;
+
+        TextSpan line = {line_start, (size_t)(line_end - line_start)};
+        report_match(context, tracker, line);
+        found_status = 1;
+        cursor = line_end;
+        if (cursor >= block_end || context->first_match_only) break;
+
+        for (size_t i = 0; i < pattern->matcher_count; i++) {
+            if (next_hits[i] != NULL && next_hits[i] < cursor) {
+                next_hits[i] = find_matcher_hit(&pattern->matchers[i], cursor, block_end);
+            }
+        }
+    }
+
+    if (next_hits != &single_hit) free(next_hits);
+    return found_status;
+}
+
+int search_block_pattern(const SearchContext *context, TextSpan block, unsigned long long *line_number) {
+    LineTracker tracker = {*line_number, block.data};
+    int found_status;
+
+    found_status = scan_block(context, &tracker, block);
+
+    if (context->line_numbers) {
+        *line_number = tracker.line_number +
+                       count_newlines(tracker.counted_upto, span_end(block) - tracker.counted_upto);
+    }
+    return found_status;
+}
+
+static void count_match(void *handler_arg, TextSpan line, unsigned long long line_number) {
+    (void)line;
+    (void)line_number;
+    (*(unsigned long long *)handler_arg)++;
+}
+
+unsigned long long count_block_matches(const SearchContext *context, TextSpan block, int first_only) {
+    SearchContext counting = *context;
+    unsigned long long match_count = 0;
+    unsigned long long line_number = 1;
+
+    counting.line_numbers = 0;
+    counting.first_match_only = first_only;
+    counting.match_handler = count_match;
+    counting.handler_arg = &match_count;
+    search_block_pattern(&counting, block, &line_number);
+    return match_count;
+}
+
+// What search_reader() has found so far. It lives in search_reader()'s
+// frame, so it survives a jump out of a mapped block whose file shrank.
+typedef struct {
+    ContextPrinter printer;
+    int with_context;
+    unsigned long long line_number;
+    unsigned long long match_count;   // matches not printed as lines
+    int printing;
+    int found_status;
+    int binary;
+    int skipped;
+} SearchProgress;
+
+static int search_blocks(const SearchContext *context, BlockReader *reader, SearchProgress *progress) {
+    TextSpan block;
+    int first_only = (context->report_mode != REPORT_COUNT);
+    int read_status;
+
+    while ((read_status = block_reader_next(reader, &block)) > 0) {
+        if (!progress->binary && !context->binary_as_text && (progress->printing || context->skip_binary) &&
+            span_has_nul(block)) {
+            progress->binary = 1;
+            progress->printing = 0;
+            progress->skipped = context->skip_binary;
+            if (progress->skipped) break;
+        }
+
+        if (progress->printing) {
+            progress->found_status |= progress->with_context
+                                      ? context_search_block(&progress->printer, block, &progress->line_number)
+                                      : search_block_pattern(context, block, &progress->line_number);
+            continue;
+        }
+
+        progress->match_count += count_block_matches(context, block, first_only);
+        if (progress->match_count > 0 && first_only) break;
+    }
+    return read_status;
+}
+
+// A mapped file that shrinks under the search ends where it was cut
+static int search_blocks_guarded(const SearchContext *context, BlockReader *reader, SearchProgress *progress) {
+    sigjmp_buf fault_jump;
+
+    if (!reader->mapped) return search_blocks(context, reader, progress);
+    if (sigsetjmp(fault_jump, 1) != 0) return 0;
+
+    mapped_read_begin(&fault_jump);
+    int read_status = search_blocks(context, reader, progress);
+    mapped_read_end();
+    return read_status;
+}
+
+static int search_reader(const SearchContext *context, BlockReader *reader) {
+    SearchProgress progress;
+
+    memset(&progress, 0, sizeof(progress));
+    progress.line_number = 1;
+    progress.printing = (context->report_mode == REPORT_LINES);
+
+    if (progress.printing && context->after_context >= 0) {
+        if (context_printer_init(&progress.printer, context) != 0) {
+            perror("malloc");
+            context_printer_release(&progress.printer);
+            return 1;
+        }
+        progress.with_context = 1;
+    }
+
+    int read_status = search_blocks_guarded(context, reader, &progress);
+    progress.found_status |= (progress.match_count > 0);
+
+    if (read_status < 0) {
+        fprintf(stderr, "Read error on '%s': ",
+                context->source_name != NULL ? context->source_name : "(standard input)");
+        perror("");
+    }
+    if (!progress.skipped) print_search_summary(context, progress.match_count, progress.binary);
+    if (progress.with_context) context_printer_release(&progress.printer);
+    return progress.found_status ? 0 : 1;
+}
+
+int search_stream_pattern(const SearchContext *context, int input_fd) {
+    BlockReader reader;
+
+    if (block_reader_init_decompressing(&reader, input_fd) != 0) {
+        perror("malloc");
+        return 1;
+    }
+
+    int search_result = search_reader(context, &reader);
+    block_reader_release(&reader);
+    return search_result;
+}
+
+int search_buffer_pattern(const SearchContext *context, TextSpan input) {
+    BlockReader reader;
+
+    block_reader_init_memory(&reader, input);
+    int search_result = search_reader(context, &reader);
+    block_reader_release(&reader);
+    return search_result;
+}
+
+int search_file_pattern(const SearchContext *base_context, const char *filename) {
+    int input_fd = open(filename, O_RDONLY);
+    if (input_fd == -1) {
+        fprintf(stderr, "Cannot open '%s': ", filename);
+        perror("");
+        return 1;
+    }
+
+    SearchContext context = *base_context;
+    context.source_name = filename;
+
+    int search_result = search_stream_pattern(&context, input_fd);
+    close(input_fd);
+
+    return search_result;
+}
+
+int search_batch_file(const SearchContext *base_context, const BatchFile *file) {
+    SearchContext context = *base_context;
+    context.source_name = file->path;
+
+    // Compressed files go through the decompressing reader from the start
+    if (file->complete &&
+        compressed_format((const unsigned char *)file->data.data, file->data.length) == DECOMPRESS_NONE) {
+        return search_buffer_pattern(&context, file->data);
+    }
+    if (file->fd >= 0) return search_stream_pattern(&context, file->fd);
+    return search_file_pattern(base_context, file->path);
+}
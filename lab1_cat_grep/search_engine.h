@@ -0,0 +1,85 @@
+#ifndef SEARCH_ENGINE_H
+#define SEARCH_ENGINE_H
+
+#include "search_pattern.h"
+#include "text_span.h"
+#include "file_batch.h"
+#include "output_buffer.h"
+
+// What a search reports about each input
+#define REPORT_LINES 0   // the matching lines themselves
+#define REPORT_COUNT 1   // -c: the number of matching lines
+#define REPORT_FILES 2   // -l: the name of the input, if anything matched
+#define REPORT_QUIET 3   // -q: nothing; only the exit status tells
+
+// Receives every matching line instead of it being printed
+typedef void (*MatchHandler)(void *handler_arg, TextSpan line, unsigned long long line_number);
+
+typedef struct {
+    const SearchPattern *pattern;
+    const char *source_name;    // NULL for standard input
+    int multi_source;           // prefix matching lines with source_name
+    int line_numbers;           // prefix matching lines with their line number
+    int report_mode;            // REPORT_*
+    int binary_as_text;         // -a: print matches from input containing NUL bytes too
+    int skip_binary;            // -r: stop at binary input without any summary
+    int first_match_only;       // stop scanning a block at its first matching line
+    int before_context;         // -B: lines printed before each matching line
+    int after_context;          // -A: lines printed after it; both -1 without context output
+    OutputBuffer *output;
+    int *printed_groups;        // -A/-B/-C: set once a group of lines went to output; shared by its inputs
+    MatchHandler match_handler; // optional, replaces printing to output
+    void *handler_arg;
+} SearchContext;
+
+// Print one matching line with the prefixes the context asks for.
+void print_search_line(const SearchContext *context, TextSpan line, unsigned long long line_number);
+
+// Print a line around a match, its prefixes ending in '-' instead of ':'.
+void print_context_line(const SearchContext *context, TextSpan line, unsigned long long line_number);
+
+// Start a group of context lines: every group but the first one written
+// to the output is preceded by a "--" line.
+void print_context_separator(const SearchContext *context);
+
+// Append output collected in memory for one input (by a worker thread),
+// with the "--" line its first group needs after earlier ones.
+// collected_groups is the printed_groups flag the input was searched with.
+void print_collected_output(const SearchContext *context, OutputBuffer *collected, int collected_groups);
+
+// Print the per-input line that replaces matching lines: the count for
+// REPORT_COUNT, the name for REPORT_FILES, and for REPORT_LINES the notice
+// that binary input matched.
+void print_search_summary(const SearchContext *context, unsigned long long match_count, int binary);
+
+// Search a buffer of complete lines. *line_number is the number of the
+// first line on entry; with line_numbers set it is advanced past the buffer.
+// Returns 1 if a line matched, 0 otherwise.
+int search_block_pattern(const SearchContext *context, TextSpan block, unsigned long long *line_number);
+
+// Count the matching lines of a block without reporting them. With
+// first_only the scan stops at the first one, so the result is 0 or 1.
+unsigned long long count_block_matches(const SearchContext *context, TextSpan block, int first_only);
+
+// Search everything readable from input_fd. Matching lines are only
+// located, never printed, unless report_mode is REPORT_LINES; except for
+// REPORT_COUNT reading stops at the first match. Once a block turns out to
+// contain a NUL byte (and binary_as_text is off) the input is binary. With
+// skip_binary it is dropped right there, whatever the report mode;
+// otherwise REPORT_LINES stops printing its matches and reading stops at
+// the first one. REPORT_LINES prints before_context and after_context
+// lines around its matches. Returns 0 if a line matched, 1 otherwise.
+int search_stream_pattern(const SearchContext *context, int input_fd);
+
+// Search input that is entirely in memory, like search_stream_pattern()
+// but without decompression.
+int search_buffer_pattern(const SearchContext *context, TextSpan input);
+
+// Open filename and search it with context->source_name set to it.
+int search_file_pattern(const SearchContext *base_context, const char *filename);
+
+// Search a file handed out by a FileBatch, from memory when it was read
+// whole, otherwise from its descriptor or by opening it again.
+int search_batch_file(const SearchContext *base_context, const BatchFile *file);
+
+#endif
@@ -0,0 +1,316 @@
+#define _GNU_SOURCE  // for strdup()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "search_pattern.h"
+#include "literal_search.h"
+
+#define PATTERN_ANCHORS (PATTERN_ANCHORED_START | PATTERN_ANCHORED_END)
+
+// A pattern of the form [^]plain string[$] is searched without regexec;
+// the anchors turn into position checks around each literal hit.
+static void analyze_pattern(const char *search_pattern, int fixed_strings, PatternAnalysis *analysis) {
+    size_t pattern_len = strlen(search_pattern);
+    int flags = 0;
+
+    memset(analysis, 0, sizeof(*analysis));
+
+    if (fixed_strings) {
+        analysis->literal = strdup(search_pattern);
+        analysis->literal_len = pattern_len;
+        analysis->flags = (analysis->literal != NULL) ? PATTERN_LITERAL : 0;
+        return;
+    }
+
+    char *body = strdup(search_pattern);
+    if (body == NULL) return;
+    char *body_start = body;
+
+    if (body_start[0] == '^') {
+        flags |= PATTERN_ANCHORED_START;
+        body_start++;
+    }
+
+    // A trailing '$' is an anchor unless it is escaped by an odd number of backslashes
+    size_t body_len = strlen(body_start);
+    if (body_len > 0 && body_start[body_len - 1] == '$') {
+        size_t backslashes = 0;
+        while (backslashes + 1 < body_len && body_start[body_len - 2 - backslashes] == '\\') {
+            backslashes++;
+        }
+        if (backslashes % 2 == 0) {
+            flags |= PATTERN_ANCHORED_END;
+            body_start[body_len - 1] = '\0';
+        }
+    }
+
+    if (extract_plain_literal(body_start, &analysis->literal, &analysis->literal_len)) {
+        // A lone '^' or '$' matches every line; only "^$" still needs both checks
+        if (analysis->literal_len == 0 && flags != PATTERN_ANCHORS) flags = 0;
+        analysis->flags = flags | PATTERN_LITERAL;
+    }
+    free(body);
+}
+
+// Back-references refer to group numbers, which joining patterns would shift
+static int has_backreference(const char *search_pattern) {
+    for (const char *cursor = search_pattern; *cursor; cursor++) {
+        if (*cursor != '\\') continue;
+        if (cursor[1] >= '1' && cursor[1] <= '9') return 1;
+        if (cursor[1] != '\0') cursor++;
+    }
+    return 0;
+}
+
+static int compile_regex_matcher(PatternMatcher *matcher) {
+    // REG_NEWLINE lets a whole block be searched while keeping per-line semantics
+    if (regcomp(&matcher->regex, matcher->regex_source, REG_EXTENDED | REG_NEWLINE) != 0) {
+        fprintf(stderr, "Pattern compilation failed\n");
+        return 1;
+    }
+    matcher->has_regex = 1;
+    return 0;
+}
+
+// regcomp has validated the syntax; when the lazy DFA supports the
+// pattern it replaces regexec, otherwise the regex stays as the fallback
+static void attach_lazy_dfa(PatternMatcher *matcher) {
+    matcher->program = regex_program_compile(matcher->regex_source);
+    if (matcher->program == NULL) return;
+
+    matcher->owns_program = 1;
+    matcher->dfa = lazy_dfa_create(matcher->program);
+    if (matcher->dfa == NULL) {
+        regex_program_free(matcher->program);
+        matcher->program = NULL;
+        return;
+    }
+
+    regfree(&matcher->regex);
+    matcher->has_regex = 0;
+}
+
+// "(p1)|(p2)|..." matches a line exactly when one of the patterns does
+static char *join_alternatives(char *const search_patterns[], const size_t indices[], size_t count) {
+    size_t total = 1;
+    char *joined;
+    char *out;
+
+    if (count == 1) return strdup(search_patterns[indices[0]]);
+
+    for (size_t i = 0; i < count; i++) {
+        total += strlen(search_patterns[indices[i]]) + 3;
+    }
+
+    joined = (char *)malloc(total);
+    if (joined == NULL) return NULL;
+
+    out = joined;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) *out++ = '|';
+        out += sprintf(out, "(%s)", search_patterns[indices[i]]);
+    }
+    return joined;
+}
+
+static int add_regex_matcher(SearchPattern *pattern, char *source) {
+    PatternMatcher *matcher = &pattern->matchers[pattern->matcher_count];
+
+    memset(matcher, 0, sizeof(*matcher));
+    matcher->kind = MATCHER_REGEX;
+    matcher->regex_source = source;
+    if (source == NULL || compile_regex_matcher(matcher) != 0) {
+        free(source);
+        return 1;
+    }
+    attach_lazy_dfa(matcher);
+    regex_required_literal(source, &matcher->required_literal, &matcher->required_len);
+    pattern->matcher_count++;
+    return 0;
+}
+
+static int add_literal_set_matcher(SearchPattern *pattern, PatternAnalysis *analyses,
+                                   const size_t indices[], size_t count) {
+    char **literals = (char **)malloc(count * sizeof(char *));
+    size_t *lengths = (size_t *)malloc(count * sizeof(size_t));
+    PatternMatcher *matcher = &pattern->matchers[pattern->matcher_count];
+
+    if (literals == NULL || lengths == NULL) {
+        free(literals);
+        free(lengths);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        literals[i] = analyses[indices[i]].literal;
+        lengths[i] = analyses[indices[i]].literal_len;
+    }
+
+    memset(matcher, 0, sizeof(*matcher));
+    matcher->kind = MATCHER_LITERAL_SET;
+    matcher->automaton = aho_corasick_build(literals, lengths, count);
+    matcher->owns_automaton = 1;
+
+    free(literals);
+    free(lengths);
+    if (matcher->automaton == NULL) {
+        fprintf(stderr, "Not enough memory for the pattern set\n");
+        return 1;
+    }
+    pattern->matcher_count++;
+    return 0;
+}
+
+// Unanchored literals share one Aho-Corasick automaton; the remaining
+// patterns share one regex, except those with back-references
+static int build_matchers(SearchPattern *pattern, char *const search_patterns[],
+                          PatternAnalysis *analyses, size_t pattern_count) {
+    size_t *literal_indices = (size_t *)malloc((pattern_count + 1) * sizeof(size_t));
+    size_t *regex_indices = (size_t *)malloc((pattern_count + 1) * sizeof(size_t));
+    size_t literal_count = 0;
+    size_t regex_count = 0;
+    int status = 0;
+
+    pattern->matchers = (PatternMatcher *)calloc(pattern_count + 2, sizeof(PatternMatcher));
+    if (literal_indices == NULL || regex_indices == NULL || pattern->matchers == NULL) {
+        free(literal_indices);
+        free(regex_indices);
+        return 1;
+    }
+
+    for (size_t i = 0; i < pattern_count && status == 0; i++) {
+        int literal = (analyses[i].flags & PATTERN_LITERAL) != 0;
+
+        if (literal && (pattern_count == 1 || !(analyses[i].flags & PATTERN_ANCHORS))) {
+            literal_indices[literal_count++] = i;
+        } else if (pattern_count > 1 && has_backreference(search_patterns[i])) {
+            status = add_regex_matcher(pattern, strdup(search_patterns[i]));
+        } else {
+            regex_indices[regex_count++] = i;
+        }
+    }
+
+    if (status == 0 && literal_count == 1) {
+        PatternMatcher *matcher = &pattern->matchers[pattern->matcher_count++];
+        matcher->kind = MATCHER_LITERAL;
+        matcher->analysis = analyses[literal_indices[0]];
+        analyses[literal_indices[0]].literal = NULL;
+    } else if (status == 0 && literal_count > 1) {
+        status = add_literal_set_matcher(pattern, analyses, literal_indices, literal_count);
+    }
+
+    if (status == 0 && regex_count > 0) {
+        status = add_regex_matcher(pattern, join_alternatives(search_patterns, regex_indices, regex_count));
+    }
+
+    free(literal_indices);
+    free(regex_indices);
+    return status;
+}
+
+static void release_matcher(PatternMatcher *matcher) {
+    switch (matcher->kind) {
+        case MATCHER_LITERAL:
+            free(matcher->analysis.literal);
+            break;
+        case MATCHER_LITERAL_SET:
+            if (matcher->owns_automaton) aho_corasick_free(matcher->automaton);
+            break;
+        case MATCHER_REGEX:
+            lazy_dfa_free(matcher->dfa);
+            if (matcher->owns_program) regex_program_free(matcher->program);
+            if (matcher->has_regex) regfree(&matcher->regex);
+            free(matcher->regex_source);
+            free(matcher->required_literal);
+            break;
+    }
+}
+
+int prepare_search_pattern(SearchPattern *pattern, char *const search_patterns[],
+                           size_t pattern_count, int fixed_strings) {
+    PatternAnalysis *analyses = (PatternAnalysis *)calloc(pattern_count + 1, sizeof(PatternAnalysis));
+    int status;
+
+    memset(pattern, 0, sizeof(*pattern));
+    if (analyses == NULL) return 1;
+
+    for (size_t i = 0; i < pattern_count; i++) {
+        analyze_pattern(search_patterns[i], fixed_strings, &analyses[i]);
+    }
+
+    status = build_matchers(pattern, search_patterns, analyses, pattern_count);
+
+    for (size_t i = 0; i < pattern_count; i++) {
+        free(analyses[i].literal);
+    }
+    free(analyses);
+
+    if (status != 0) release_search_pattern(pattern);
+    return status;
+}
+
+int clone_search_pattern(SearchPattern *copy, const SearchPattern *original) {
+    memset(copy, 0, sizeof(*copy));
+    copy->matchers = (PatternMatcher *)calloc(original->matcher_count + 1, sizeof(PatternMatcher));
+    if (copy->matchers == NULL) return 1;
+
+    for (size_t i = 0; i < original->matcher_count; i++) {
+        const PatternMatcher *source = &original->matchers[i];
+        PatternMatcher *matcher = &copy->matchers[i];
+        int failed = 0;
+
+        matcher->kind = source->kind;
+        switch (source->kind) {
+            case MATCHER_LITERAL:
+                matcher->analysis = source->analysis;
+                matcher->analysis.literal = (char *)malloc(source->analysis.literal_len + 1);
+                failed = (matcher->analysis.literal == NULL);
+                if (!failed) {
+                    memcpy(matcher->analysis.literal, source->analysis.literal, source->analysis.literal_len + 1);
+                }
+                break;
+            case MATCHER_LITERAL_SET:
+                // The automaton is read-only once built
+                matcher->automaton = source->automaton;
+                matcher->owns_automaton = 0;
+                break;
+            case MATCHER_REGEX:
+                matcher->regex_source = strdup(source->regex_source);
+                if (matcher->regex_source != NULL && source->program != NULL) {
+                    // The program is read-only; only the state cache is per thread
+                    matcher->program = source->program;
+                    matcher->dfa = lazy_dfa_create(source->program);
+                    failed = (matcher->dfa == NULL);
+                } else {
+                    failed = (matcher->regex_source == NULL || compile_regex_matcher(matcher) != 0);
+                }
+                if (!failed && source->required_literal != NULL) {
+                    matcher->required_literal = strdup(source->required_literal);
+                    matcher->required_len = source->required_len;
+                    failed = (matcher->required_literal == NULL);
+                }
+                if (failed) {
+                    lazy_dfa_free(matcher->dfa);
+                    if (matcher->has_regex) regfree(&matcher->regex);
+                    free(matcher->regex_source);
+                }
+                break;
+        }
+
+        if (failed) {
+            release_search_pattern(copy);
+            return 1;
+        }
+        copy->matcher_count++;
+    }
+    return 0;
+}
+
+void release_search_pattern(SearchPattern *pattern) {
+    for (size_t i = 0; i < pattern->matcher_count; i++) {
+        release_matcher(&pattern->matchers[i]);
+    }
+    free(pattern->matchers);
+    pattern->matchers = NULL;
+    pattern->matcher_count = 0;
+}
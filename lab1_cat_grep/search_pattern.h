@@ -0,0 +1,56 @@
+#ifndef SEARCH_PATTERN_H
+#define SEARCH_PATTERN_H
+
+#include <stddef.h>
+#include <regex.h>
+#include "aho_corasick.h"
+#include "regex_program.h"
+#include "lazy_dfa.h"
+
+#define PATTERN_LITERAL 0x01
+#define PATTERN_ANCHORED_START 0x02
+#define PATTERN_ANCHORED_END 0x04
+
+#define MATCHER_LITERAL 1       // one plain string, optionally anchored
+#define MATCHER_LITERAL_SET 2   // many unanchored plain strings (Aho-Corasick)
+#define MATCHER_REGEX 3         // one or more ERE patterns joined with '|'
+
+// Result of analyzing a pattern string
+typedef struct {
+    int flags;
+    char *literal;       // pattern body as a plain string, for PATTERN_LITERAL
+    size_t literal_len;
+} PatternAnalysis;
+
+typedef struct {
+    int kind;
+    PatternAnalysis analysis;       // MATCHER_LITERAL
+    AhoCorasick *automaton;         // MATCHER_LITERAL_SET, shared by clones
+    int owns_automaton;
+    char *regex_source;             // MATCHER_REGEX
+    RegexProgram *program;          // shared by clones, NULL if regexec is needed
+    int owns_program;
+    LazyDfa *dfa;                   // per thread
+    int has_regex;                  // regex is compiled (the fallback)
+    regex_t regex;
+    char *required_literal;         // every match contains it, or NULL
+    size_t required_len;
+} PatternMatcher;
+
+// Every pattern given with -e/-f (or the single positional pattern). A line
+// matches if any pattern matches it; each matcher covers a group of patterns.
+typedef struct {
+    PatternMatcher *matchers;
+    size_t matcher_count;
+} SearchPattern;
+
+// Analyze and compile a pattern list. Returns 0 on success.
+int prepare_search_pattern(SearchPattern *pattern, char *const search_patterns[],
+                           size_t pattern_count, int fixed_strings);
+
+// Independent copy with its own compiled regexes, for use on another thread.
+int clone_search_pattern(SearchPattern *copy, const SearchPattern *original);
+
+void release_search_pattern(SearchPattern *pattern);
+
+#endif
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE  // for madvise()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "search_pool.h"
+#include "decompressor.h"
+#include "block_reader.h"
+
+typedef struct {
+    TextSpan line;          // points into the file mapping
+    unsigned long long line_number;  // relative to the start of the chunk
+} MatchRecord;
+
+typedef struct {
+    int fd;
+    char *map;
+    size_t size;
+} MappedFile;
+
+typedef struct {
+    const char *filename;
+    int status;
+    int done;
+
+    // Whole-file jobs: matches are formatted into a memory buffer
+    OutputBuffer output;
+    int printed_groups;     // -A/-B/-C groups in output, as if it came first
+
+    // Chunk jobs: one newline-aligned slice of a mapped file; matches are
+    // recorded as spans and formatted once the line number base is known
+    MappedFile *mapped;
+    size_t chunk_index;
+    size_t chunk_count;
+    MatchRecord *matches;
+    size_t match_count;
+    size_t match_capacity;
+    unsigned long long newline_count;
+    int binary;             // the chunk contains a NUL byte; matches were not recorded
+    unsigned long long match_total;  // matches counted instead of recorded
+    int record_error;       // errno of a match that could not be recorded; the file's matches are dropped
+    int truncated;          // the file shrank under the chunk: it ends in this chunk
+} SearchJob;
+
+typedef struct {
+    SearchJob *jobs;
+    size_t job_count;
+    size_t next_job;        // first job nobody has taken yet
+    int cancelled;          // REPORT_QUIET: a match was found, remaining jobs are skipped
+    const SearchContext *base_context;
+    pthread_mutex_t lock;
+    pthread_cond_t job_finished;
+} SearchPool;
+
+static void run_file_job(const SearchContext *worker_context, SearchJob *job) {
+    SearchContext context = *worker_context;
+
+    if (output_init(&job->output, -1, 0) != 0) {
+        perror("malloc");
+        job->status = 1;
+        return;
+    }
+
+    context.output = &job->output;
+    context.printed_groups = &job->printed_groups;
+    job->status = search_file_pattern(&context, job->filename);
+}
+
+static void record_match(void *handler_arg, TextSpan line, unsigned long long line_number) {
+    SearchJob *job = (SearchJob *)handler_arg;
+
+    if (job->record_error != 0) return;
+    if (job->match_count == job->match_capacity) {
+        size_t capacity = job->match_capacity ? job->match_capacity * 2 : 64;
+        MatchRecord *grown = (MatchRecord *)realloc(job->matches, capacity * sizeof(MatchRecord));
+        if (grown == NULL) {
+            job->record_error = errno;
+            return;
+        }
+        job->matches = grown;
+        job->match_capacity = capacity;
+    }
+
+    job->matches[job->match_count].line = line;
+    job->matches[job->match_count].line_number = line_number;
+    job->match_count++;
+}
+
+// First line start at or after offset
+static size_t chunk_boundary(const MappedFile *mapped, size_t offset) {
+    if (offset == 0) return 0;
+    if (offset >= mapped->size) return mapped->size;
+
+    const char *newline = memchr(mapped->map + offset - 1, '\n', mapped->size - offset + 1);
+    return (newline != NULL) ? (size_t)(newline - mapped->map) + 1 : mapped->size;
+}
+
+static void run_chunk_job(const SearchContext *worker_context, SearchJob *job) {
+    const MappedFile *mapped = job->mapped;
+    size_t nominal_size = mapped->size / job->chunk_count;
+    size_t start = chunk_boundary(mapped, nominal_size * job->chunk_index);
+    size_t end = (job->chunk_index + 1 == job->chunk_count)
+                 ? mapped->size
+                 : chunk_boundary(mapped, nominal_size * (job->chunk_index + 1));
+    TextSpan chunk = {mapped->map + start, end - start};
+    unsigned long long line_number = 1;
+    int found = 0;
+
+    SearchContext context = *worker_context;
+    context.source_name = job->filename;
+    context.match_handler = record_match;
+    context.handler_arg = job;
+
+    int printing = (context.report_mode == REPORT_LINES);
+
+    job->binary = printing && !context.binary_as_text && span_has_nul(chunk);
+
+    // A line longer than a chunk leaves the chunks it covers empty. Binary
+    // chunks print nothing, so their lines need no counting either.
+    if (chunk.length == 0) {
+        found = 0;
+    } else if (printing && !job->binary) {
+        found = search_block_pattern(&context, chunk, &line_number);
+    } else {
+        job->match_total = count_block_matches(&context, chunk, context.report_mode != REPORT_COUNT);
+        found = (job->match_total > 0);
+    }
+
+    job->newline_count = line_number - 1;
+    job->status = (found && job->record_error == 0) ? 0 : 1;
+}
+
+// A file that shrinks while its chunks are searched raises SIGBUS in the
+// chunk that reaches past its new end
+static void run_chunk_job_guarded(const SearchContext *worker_context, SearchJob *job) {
+    sigjmp_buf fault_jump;
+
+    if (sigsetjmp(fault_jump, 1) != 0) {
+        job->truncated = 1;
+        job->status = 1;
+        return;
+    }
+    mapped_read_begin(&fault_jump);
+    run_chunk_job(worker_context, job);
+    mapped_read_end();
+}
+
+static void *search_worker(void *arg) {
+    SearchPool *pool = (SearchPool *)arg;
+    SearchPattern own_pattern;
+    SearchContext worker_context = *pool->base_context;
+    int has_pattern = (clone_search_pattern(&own_pattern, pool->base_context->pattern) == 0);
+
+    // regex_t is not shared between threads; each worker compiles its own copy
+    if (has_pattern) worker_context.pattern = &own_pattern;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        size_t job_index = pool->next_job;
+        int cancelled = pool->cancelled;
+        if (job_index < pool->job_count) pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (job_index >= pool->job_count) break;
+
+        SearchJob *job = &pool->jobs[job_index];
+        if (!has_pattern || cancelled) {
+            job->status = 1;
+        } else if (job->mapped != NULL) {
+            run_chunk_job_guarded(&worker_context, job);
+        } else {
+            run_file_job(&worker_context, job);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (job->status == 0 && worker_context.report_mode == REPORT_QUIET) pool->cancelled = 1;
+        job->done = 1;
+        pthread_cond_broadcast(&pool->job_finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (has_pattern) release_search_pattern(&own_pattern);
+    return NULL;
+}
+
+static void unmap_large_file(MappedFile *mapped) {
+    munmap(mapped->map, mapped->size);
+    close(mapped->fd);
+    free(mapped);
+}
+
+// Map a large regular file so its chunks can be searched concurrently.
+// Returns NULL when the file should be searched as a whole instead.
+static MappedFile *map_large_file(const char *filename) {
+    struct stat info;
+    MappedFile *mapped;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1) return NULL;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size < PARALLEL_FILE_THRESHOLD) {
+        close(fd);
+        return NULL;
+    }
+
+    mapped = (MappedFile *)malloc(sizeof(MappedFile));
+    if (mapped == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    mapped->fd = fd;
+    mapped->size = (size_t)info.st_size;
+    mapped->map = mmap(NULL, mapped->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped->map == MAP_FAILED) {
+        close(fd);
+        free(mapped);
+        return NULL;
+    }
+
+    // Compressed files cannot be split; they are decompressed as a whole.
+    // The magic is read with pread(): the file may already be shorter.
+    unsigned char magic[DECOMPRESS_MAGIC_SIZE];
+    ssize_t magic_length = pread(fd, magic, sizeof(magic), 0);
+    if (magic_length < 0 || compressed_format(magic, (size_t)magic_length) != DECOMPRESS_NONE) {
+        unmap_large_file(mapped);
+        return NULL;
+    }
+
+    madvise(mapped->map, mapped->size, MADV_SEQUENTIAL);
+    return mapped;
+}
+
+// One job per file, except that when there are fewer files than workers,
+// large regular files are split into chunks to keep every worker busy
+// (unless allow_chunks is off)
+static SearchJob *plan_jobs(char *const files[], int file_count, int worker_count, int allow_chunks,
+                            size_t *job_count) {
+    MappedFile **mapped_files = (MappedFile **)calloc(file_count, sizeof(MappedFile *));
+    size_t *chunk_counts = (size_t *)malloc(file_count * sizeof(size_t));
+    SearchJob *jobs = NULL;
+    size_t total_jobs = 0;
+
+    if (mapped_files != NULL && chunk_counts != NULL) {
+        for (int i = 0; i < file_count; i++) {
+            chunk_counts[i] = 1;
+            if (allow_chunks && file_count < worker_count) mapped_files[i] = map_large_file(files[i]);
+
+            if (mapped_files[i] != NULL) {
+                size_t chunks = mapped_files[i]->size / MIN_CHUNK_SIZE;
+                size_t max_chunks = (size_t)worker_count * CHUNKS_PER_WORKER;
+                chunk_counts[i] = (chunks < max_chunks) ? chunks : max_chunks;
+            }
+            total_jobs += chunk_counts[i];
+        }
+        jobs = (SearchJob *)calloc(total_jobs, sizeof(SearchJob));
+    }
+
+    if (jobs != NULL) {
+        size_t job_index = 0;
+        for (int i = 0; i < file_count; i++) {
+            for (size_t chunk = 0; chunk < chunk_counts[i]; chunk++) {
+                SearchJob *job = &jobs[job_index++];
+                job->filename = files[i];
+                job->mapped = mapped_files[i];
+                job->chunk_index = chunk;
+                job->chunk_count = chunk_counts[i];
+            }
+            mapped_files[i] = NULL;  // now owned by the jobs
+        }
+        *job_count = total_jobs;
+    }
+
+    if (mapped_files != NULL) {
+        for (int i = 0; i < file_count; i++) {
+            if (mapped_files[i] != NULL) unmap_large_file(mapped_files[i]);
+        }
+    }
+    free(mapped_files);
+    free(chunk_counts);
+    return jobs;
+}
+
+static void print_chunk_matches(const SearchContext *context, const SearchJob *chunks, size_t chunk_count) {
+    unsigned long long line_base = 0;
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        const SearchJob *job = &chunks[i];
+        for (size_t j = 0; j < job->match_count; j++) {
+            const MatchRecord *record = &job->matches[j];
+            print_search_line(context, record->line, line_base + record->line_number);
+        }
+        line_base += job->newline_count;
+    }
+}
+
+// The lines are printed from the mapping, which may have shrunk since
+static void print_chunk_matches_guarded(const SearchContext *context, const SearchJob *chunks,
+                                        size_t chunk_count) {
+    sigjmp_buf fault_jump;
+
+    if (sigsetjmp(fault_jump, 1) != 0) return;
+    mapped_read_begin(&fault_jump);
+    print_chunk_matches(context, chunks, chunk_count);
+    mapped_read_end();
+}
+
+// Print the matches of a file searched in chunks, once all of them are done.
+// A NUL byte in any chunk makes the whole file binary, as it would be for a
+// sequential read of a file that fits one mapping window. If the file
+// shrank, it ends in the first chunk that found it shorter, with the
+// matches that chunk recorded before. If a chunk could not record all of
+// its matches, nothing of the file is printed.
+// Returns 0 if a line matched, 1 otherwise or on failure.
+static int emit_chunked_file(const SearchContext *base_context, SearchJob *chunks, size_t chunk_count) {
+    SearchContext context = *base_context;
+    unsigned long long match_total = 0;
+    size_t kept_count = chunk_count;
+    int file_binary = 0;
+    int status;
+
+    context.source_name = chunks[0].filename;
+    for (size_t i = 0; i < chunk_count && kept_count == chunk_count; i++) {
+        if (chunks[i].truncated) kept_count = i + 1;
+    }
+
+    for (size_t i = 0; i < kept_count; i++) {
+        if (chunks[i].record_error != 0) {
+            fprintf(stderr, "Error searching '%s': %s\n", chunks[i].filename, strerror(chunks[i].record_error));
+            for (size_t j = 0; j < chunk_count; j++) free(chunks[j].matches);
+            return 1;
+        }
+        match_total += chunks[i].match_total + chunks[i].match_count;
+        file_binary |= chunks[i].binary;
+    }
+
+    if (!file_binary) print_chunk_matches_guarded(&context, chunks, kept_count);
+    print_search_summary(&context, match_total, file_binary);
+    status = (match_total > 0) ? 0 : 1;
+
+    for (size_t i = 0; i < chunk_count; i++) free(chunks[i].matches);
+    return status;
+}
+
+int search_files_parallel(const SearchContext *base_context, char *const files[],
+                          int file_count, int worker_count) {
+    SearchPool pool;
+    pthread_t *workers;
+    int started = 0;
+    int overall_status = 0;
+
+    memset(&pool, 0, sizeof(pool));
+    // Context lines may cross chunk boundaries, so such files are searched whole
+    int allow_chunks = (base_context->after_context < 0);
+    pool.jobs = plan_jobs(files, file_count, worker_count, allow_chunks, &pool.job_count);
+    if (pool.job_count > 0 && (size_t)worker_count > pool.job_count) {
+        worker_count = (int)pool.job_count;
+    }
+    workers = (pthread_t *)malloc(worker_count * sizeof(pthread_t));
+    if (pool.jobs == NULL || workers == NULL) {
+        perror("malloc");
+        free(pool.jobs);
+        free(workers);
+        return 1;
+    }
+
+    pool.base_context = base_context;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.job_finished, NULL);
+
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], NULL, search_worker, &pool) != 0) break;
+        started++;
+    }
+
+    // Without any worker the calling thread does all the work itself
+    if (started == 0) search_worker(&pool);
+
+    // Emit results in argument order as soon as each prefix is complete
+    for (size_t i = 0; i < pool.job_count; i++) {
+        SearchJob *job = &pool.jobs[i];
+
+        pthread_mutex_lock(&pool.lock);
+        while (!job->done) {
+            pthread_cond_wait(&pool.job_finished, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        if (job->mapped == NULL) {
+            if (job->output.data != NULL) {
+                print_collected_output(base_context, &job->output, job->printed_groups);
+                output_release(&job->output);
+            }
+            overall_status |= job->status;
+            continue;
+        }
+
+        if (job->chunk_index + 1 == job->chunk_count) {
+            overall_status |= emit_chunked_file(base_context, job - job->chunk_index, job->chunk_count);
+            unmap_large_file(job->mapped);
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool.job_finished);
+    pthread_mutex_destroy(&pool.lock);
+    free(workers);
+    free(pool.jobs);
+    if (base_context->report_mode == REPORT_QUIET) return pool.cancelled ? 0 : 1;
+    return overall_status;
+}
@@ -0,0 +1,21 @@
+#ifndef SEARCH_POOL_H
+#define SEARCH_POOL_H
+
+#include <sys/types.h>
+#include "search_engine.h"
+
+#define PARALLEL_FILE_THRESHOLD ((off_t)64 * 1024 * 1024)
+#define MIN_CHUNK_SIZE ((size_t)8 * 1024 * 1024)
+#define CHUNKS_PER_WORKER 4
+
+// Search files[0..file_count) on worker_count threads. Each file's matches
+// are buffered and written to base_context->output in argument order.
+// With fewer files than workers, regular files of PARALLEL_FILE_THRESHOLD
+// bytes or more are split into newline-aligned chunks searched concurrently.
+// Returns the OR of the per-file statuses, like the sequential loop. With
+// REPORT_QUIET, files not started by the first match are skipped and the
+// result is 0 if any file matched.
+int search_files_parallel(const SearchContext *base_context, char *const files[],
+                          int file_count, int worker_count);
+
+#endif
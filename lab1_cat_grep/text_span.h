@@ -0,0 +1,34 @@
+#ifndef TEXT_SPAN_H
+#define TEXT_SPAN_H
+
+#include <stddef.h>
+#include <string.h>
+
+// A run of input bytes given by pointer and length. Spans may contain NUL
+// bytes and are never NUL-terminated, so they are only ever written with
+// fwrite()/write(), never printed as strings.
+typedef struct {
+    const char *data;
+    size_t length;
+} TextSpan;
+
+static inline const char *span_end(TextSpan span) {
+    return span.data + span.length;
+}
+
+// Split the first line (with its newline, if it has one) off the front of rest
+static inline TextSpan span_take_line(TextSpan *rest) {
+    const char *newline = memchr(rest->data, '\n', rest->length);
+    TextSpan line = {rest->data, (newline != NULL) ? (size_t)(newline - rest->data) + 1 : rest->length};
+
+    rest->data += line.length;
+    rest->length -= line.length;
+    return line;
+}
+
+// Text never contains NUL bytes, so one is taken as the sign of binary data
+static inline int span_has_nul(TextSpan span) {
+    return memchr(span.data, '\0', span.length) != NULL;
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "text_transform.h"
+
+#define COUNTER_END 30          // counter[COUNTER_END] is the tab
+#define COUNTER_WIDTH 6
+
+int text_transform_init(TextTransform *transform, int output_fd, int options) {
+    memset(transform, 0, sizeof(*transform));
+    transform->output_fd = output_fd;
+    transform->options = options;
+
+    memset(transform->counter, ' ', sizeof(transform->counter));
+    transform->counter[COUNTER_END - 1] = '1';
+    transform->counter[COUNTER_END] = '\t';
+    transform->counter_start = COUNTER_END - 1;
+
+    transform->buffer = (char *)malloc(TRANSFORM_BUFFER_SIZE);
+    return (transform->buffer != NULL) ? 0 : -1;
+}
+
+// Decimal increment in place, so numbers are never formatted
+static void advance_counter(TextTransform *transform) {
+    size_t digit = COUNTER_END - 1;
+
+    while (digit >= transform->counter_start && transform->counter[digit] == '9') {
+        transform->counter[digit--] = '0';
+    }
+    if (digit < transform->counter_start) {
+        transform->counter_start = digit;
+        transform->counter[digit] = '1';
+    } else {
+        transform->counter[digit]++;
+    }
+}
+
+static void close_pending_part(TextTransform *transform) {
+    if (transform->buffer_used == transform->pending_start) return;
+
+    struct iovec *part = &transform->parts[transform->part_count++];
+    part->iov_base = transform->buffer + transform->pending_start;
+    part->iov_len = transform->buffer_used - transform->pending_start;
+    transform->pending_start = transform->buffer_used;
+}
+
+static int flush_parts(TextTransform *transform) {
+    struct iovec *part = transform->parts;
+
+    close_pending_part(transform);
+    int remaining = transform->part_count;
+
+    while (remaining > 0) {
+        ssize_t written = writev(transform->output_fd, part, remaining);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        // Skip what a short write did take
+        while (remaining > 0 && (size_t)written >= part->iov_len) {
+            written -= part->iov_len;
+            part++;
+            remaining--;
+        }
+        if (remaining > 0) {
+            part->iov_base = (char *)part->iov_base + written;
+            part->iov_len -= written;
+        }
+    }
+
+    transform->part_count = 0;
+    transform->buffer_used = 0;
+    transform->pending_start = 0;
+    return 0;
+}
+
+static void append_bytes(TextTransform *transform, const char *data, size_t length) {
+    memcpy(transform->buffer + transform->buffer_used, data, length);
+    transform->buffer_used += length;
+}
+
+// Room for a prefix, a short line and a marker, plus the parts they may need
+static int reserve_line(TextTransform *transform) {
+    if (transform->buffer_used + sizeof(transform->counter) + LONG_LINE_THRESHOLD + 2 > TRANSFORM_BUFFER_SIZE ||
+        transform->part_count + 3 > TRANSFORM_PART_COUNT) {
+        return flush_parts(transform);
+    }
+    return 0;
+}
+
+int text_transform_block(TextTransform *transform, TextSpan block) {
+    int options = transform->options;
+
+    while (block.length > 0) {
+        TextSpan line = span_take_line(&block);
+        int has_newline = (line.data[line.length - 1] == '\n');
+        size_t content_length = line.length;
+        int numbered = (options & NONBLANK_NUM_FLAG) ? (line.data[0] != '\n') : (options & LINE_NUM_FLAG);
+
+        if (reserve_line(transform) != 0) return -1;
+
+        if (numbered) {
+            size_t first = transform->counter_start;
+            if (first > COUNTER_END - COUNTER_WIDTH) first = COUNTER_END - COUNTER_WIDTH;
+            append_bytes(transform, transform->counter + first, COUNTER_END + 1 - first);
+            advance_counter(transform);
+        }
+
+        // -E replaces the newline (if any) with "$\n"
+        if ((options & END_MARKER_FLAG) && has_newline) content_length--;
+
+        if (content_length < LONG_LINE_THRESHOLD) {
+            append_bytes(transform, line.data, content_length);
+        } else {
+            close_pending_part(transform);
+            transform->parts[transform->part_count].iov_base = (void *)line.data;
+            transform->parts[transform->part_count].iov_len = content_length;
+            transform->part_count++;
+        }
+
+        if (options & END_MARKER_FLAG) append_bytes(transform, "$\n", 2);
+    }
+
+    // Parts may point into the block, which is about to be replaced
+    return flush_parts(transform);
+}
+
+void text_transform_release(TextTransform *transform) {
+    free(transform->buffer);
+    transform->buffer = NULL;
+}
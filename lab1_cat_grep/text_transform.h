@@ -0,0 +1,39 @@
+#ifndef TEXT_TRANSFORM_H
+#define TEXT_TRANSFORM_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include "text_span.h"
+
+#define LINE_NUM_FLAG 0x01
+#define NONBLANK_NUM_FLAG 0x02
+#define END_MARKER_FLAG 0x04
+
+#define TRANSFORM_BUFFER_SIZE (256 * 1024)
+#define TRANSFORM_PART_COUNT 512        // iovecs per writev(), below IOV_MAX
+#define LONG_LINE_THRESHOLD 256         // longer lines are written from the input block
+
+// Applies -n, -b and -E to blocks of complete lines. Line numbers and
+// markers (and short lines) are assembled in one buffer; long lines are
+// referenced in place; everything goes out with writev().
+typedef struct {
+    int output_fd;
+    int options;
+    char counter[32];           // "%6d\t" of the next line number, right-aligned
+    size_t counter_start;       // first digit in counter
+    char *buffer;
+    size_t buffer_used;
+    size_t pending_start;       // buffer bytes not yet covered by a part
+    struct iovec parts[TRANSFORM_PART_COUNT];
+    int part_count;
+} TextTransform;
+
+int text_transform_init(TextTransform *transform, int output_fd, int options);
+
+// Returns 0 on success, -1 with errno set if writing failed. Output that
+// refers to the block is written before returning.
+int text_transform_block(TextTransform *transform, TextSpan block);
+
+void text_transform_release(TextTransform *transform);
+
+#endif
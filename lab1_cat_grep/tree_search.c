@@ -0,0 +1,283 @@
+#define _GNU_SOURCE  // for getdents64()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tree_search.h"
+
+typedef struct WalkItem {
+    struct WalkItem *next;
+    int is_directory;
+    char path[];
+} WalkItem;
+
+// Items found in one directory, queued together under a single lock
+typedef struct {
+    WalkItem *files_head;
+    WalkItem *files_tail;
+    WalkItem *directories;
+} WalkBatch;
+
+typedef struct {
+    WalkBatch queue;        // files in discovery order, directories as a stack
+    size_t active;          // items taken by a worker and not finished yet
+    int found;
+    int cancelled;          // REPORT_QUIET: a match was found, the rest is skipped
+    const SearchContext *base_context;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_mutex_t output_lock;
+} TreeSearch;
+
+static WalkItem *make_walk_item(const char *directory, const char *name, int is_directory) {
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(name);
+    int needs_slash = (directory_length > 0 && directory[directory_length - 1] != '/');
+    WalkItem *item = (WalkItem *)malloc(sizeof(WalkItem) + directory_length + needs_slash + name_length + 1);
+
+    if (item == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    item->next = NULL;
+    item->is_directory = is_directory;
+    memcpy(item->path, directory, directory_length);
+    if (needs_slash) item->path[directory_length] = '/';
+    memcpy(item->path + directory_length + needs_slash, name, name_length + 1);
+    return item;
+}
+
+static void batch_add(WalkBatch *batch, WalkItem *item) {
+    if (item->is_directory) {
+        item->next = batch->directories;
+        batch->directories = item;
+    } else if (batch->files_tail != NULL) {
+        batch->files_tail->next = item;
+        batch->files_tail = item;
+    } else {
+        batch->files_head = item;
+        batch->files_tail = item;
+    }
+}
+
+static void free_walk_items(WalkItem *item) {
+    while (item != NULL) {
+        WalkItem *next = item->next;
+        free(item);
+        item = next;
+    }
+}
+
+static void queue_batch(TreeSearch *search, WalkBatch *batch) {
+    if (batch->files_head == NULL && batch->directories == NULL) return;
+
+    pthread_mutex_lock(&search->lock);
+    if (batch->files_head != NULL) {
+        if (search->queue.files_tail != NULL) {
+            search->queue.files_tail->next = batch->files_head;
+        } else {
+            search->queue.files_head = batch->files_head;
+        }
+        search->queue.files_tail = batch->files_tail;
+    }
+    while (batch->directories != NULL) {
+        WalkItem *directory = batch->directories;
+        batch->directories = directory->next;
+        directory->next = search->queue.directories;
+        search->queue.directories = directory;
+    }
+    pthread_cond_broadcast(&search->changed);
+    pthread_mutex_unlock(&search->lock);
+}
+
+// Returns NULL once nothing is queued and no worker can queue more
+static WalkItem *take_walk_item(TreeSearch *search) {
+    WalkItem *item = NULL;
+
+    pthread_mutex_lock(&search->lock);
+    for (;;) {
+        if (search->cancelled) break;
+        if (search->queue.files_head != NULL) {
+            item = search->queue.files_head;
+            search->queue.files_head = item->next;
+            if (search->queue.files_head == NULL) search->queue.files_tail = NULL;
+            break;
+        }
+        if (search->queue.directories != NULL) {
+            item = search->queue.directories;
+            search->queue.directories = item->next;
+            break;
+        }
+        if (search->active == 0) break;
+        pthread_cond_wait(&search->changed, &search->lock);
+    }
+    if (item != NULL) search->active++;
+    pthread_mutex_unlock(&search->lock);
+    return item;
+}
+
+static void finish_walk_item(TreeSearch *search, int found) {
+    pthread_mutex_lock(&search->lock);
+    search->active--;
+    search->found |= found;
+    if (found && search->base_context->report_mode == REPORT_QUIET) search->cancelled = 1;
+    pthread_cond_broadcast(&search->changed);
+    pthread_mutex_unlock(&search->lock);
+}
+
+// d_type saves a stat() per entry; only file systems that leave it
+// DT_UNKNOWN need fstatat() relative to the directory descriptor
+static void walk_directory(TreeSearch *search, const char *path, char *entries) {
+    WalkBatch batch = {NULL, NULL, NULL};
+    int directory_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (directory_fd == -1) {
+        fprintf(stderr, "Cannot open '%s': ", path);
+        perror("");
+        return;
+    }
+
+    for (;;) {
+        ssize_t bytes_read = getdents64(directory_fd, entries, WALK_BUFFER_SIZE);
+        if (bytes_read < 0) {
+            fprintf(stderr, "Cannot read directory '%s': ", path);
+            perror("");
+            break;
+        }
+        if (bytes_read == 0) break;
+
+        for (ssize_t offset = 0; offset < bytes_read;) {
+            const struct dirent64 *entry = (const struct dirent64 *)(entries + offset);
+            unsigned char type = entry->d_type;
+            offset += entry->d_reclen;
+
+            // ".", ".." and hidden entries
+            if (entry->d_name[0] == '.') continue;
+
+            if (type == DT_UNKNOWN) {
+                struct stat info;
+                if (fstatat(directory_fd, entry->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                type = IFTODT(info.st_mode);
+            }
+            if (type != DT_DIR && type != DT_REG) continue;
+
+            WalkItem *item = make_walk_item(path, entry->d_name, type == DT_DIR);
+            if (item != NULL) batch_add(&batch, item);
+        }
+
+        // Hand out what was found so far; huge directories need several reads
+        queue_batch(search, &batch);
+        batch.files_head = NULL;
+        batch.files_tail = NULL;
+    }
+
+    close(directory_fd);
+}
+
+// The file's output is collected first so it reaches the output in one piece
+static int search_tree_file(TreeSearch *search, const SearchContext *worker_context, const char *path) {
+    SearchContext context = *worker_context;
+    OutputBuffer output;
+    int printed_groups = 0;
+
+    if (output_init(&output, -1, 0) != 0) {
+        perror("malloc");
+        return 1;
+    }
+
+    context.output = &output;
+    context.printed_groups = &printed_groups;
+    int status = search_file_pattern(&context, path);
+
+    if (output.length > 0) {
+        pthread_mutex_lock(&search->output_lock);
+        print_collected_output(search->base_context, &output, printed_groups);
+        pthread_mutex_unlock(&search->output_lock);
+    }
+    output_release(&output);
+    return status;
+}
+
+static void *tree_worker(void *arg) {
+    TreeSearch *search = (TreeSearch *)arg;
+    SearchPattern own_pattern;
+    SearchContext worker_context = *search->base_context;
+    int has_pattern = (clone_search_pattern(&own_pattern, search->base_context->pattern) == 0);
+    char *entries = (char *)malloc(WALK_BUFFER_SIZE);
+    WalkItem *item;
+
+    // regex_t is not shared between threads; each worker compiles its own copy
+    if (has_pattern) worker_context.pattern = &own_pattern;
+    if (entries == NULL) perror("malloc");
+
+    while ((item = take_walk_item(search)) != NULL) {
+        int found = 0;
+
+        if (item->is_directory) {
+            if (entries != NULL) walk_directory(search, item->path, entries);
+        } else if (has_pattern) {
+            found = (search_tree_file(search, &worker_context, item->path) == 0);
+        }
+        free(item);
+        finish_walk_item(search, found);
+    }
+
+    free(entries);
+    if (has_pattern) release_search_pattern(&own_pattern);
+    return NULL;
+}
+
+int search_tree_parallel(const SearchContext *base_context, char *const roots[],
+                         int root_count, int worker_count) {
+    TreeSearch search;
+    WalkBatch roots_batch = {NULL, NULL, NULL};
+    pthread_t *workers = (pthread_t *)malloc(worker_count * sizeof(pthread_t));
+    int started = 0;
+
+    if (workers == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    memset(&search, 0, sizeof(search));
+    search.base_context = base_context;
+    pthread_mutex_init(&search.lock, NULL);
+    pthread_cond_init(&search.changed, NULL);
+    pthread_mutex_init(&search.output_lock, NULL);
+
+    // Roots are taken as given: symbolic links are followed, and anything
+    // that is not a directory is searched (or fails to open) as a file
+    for (int i = 0; i < root_count; i++) {
+        struct stat info;
+        int is_directory = (stat(roots[i], &info) == 0 && S_ISDIR(info.st_mode));
+        WalkItem *item = make_walk_item("", roots[i], is_directory);
+        if (item != NULL) batch_add(&roots_batch, item);
+    }
+    queue_batch(&search, &roots_batch);
+
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], NULL, tree_worker, &search) != 0) break;
+        started++;
+    }
+
+    // Without any worker the calling thread does all the work itself
+    if (started == 0) tree_worker(&search);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    // Only a cancelled search leaves items behind
+    free_walk_items(search.queue.files_head);
+    free_walk_items(search.queue.directories);
+
+    pthread_mutex_destroy(&search.output_lock);
+    pthread_cond_destroy(&search.changed);
+    pthread_mutex_destroy(&search.lock);
+    free(workers);
+    return search.found ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#ifndef TREE_SEARCH_H
+#define TREE_SEARCH_H
+
+#include "search_engine.h"
+
+#define WALK_BUFFER_SIZE (64 * 1024)
+
+// Search roots[0..root_count) and, recursively, everything below the ones
+// that are directories, on worker_count threads. The same workers list
+// directories (getdents64 on an O_DIRECTORY descriptor) and search files;
+// files already found are always taken before another directory is
+// listed, so searching starts with the first directory and the queue of
+// pending files stays short. Hidden entries, symbolic links and anything
+// but regular files and directories are skipped below the roots.
+// Each file's output is written in one piece as soon as it is searched,
+// so files appear in no particular order.
+// Returns 0 if any file matched, 1 otherwise.
+int search_tree_parallel(const SearchContext *base_context, char *const roots[],
+                         int root_count, int worker_count);
+
+#endif
@@ -1,5 +1,7 @@
+#define _GNU_SOURCE  // for getdents64(), qsort_r()
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <stdlib.h>
@@ -11,20 +13,30 @@
 #include <time.h>
 #include <limits.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #define FLAG_ALL 0x01
 #define FLAG_LONG 0x02
 #define FLAG_HELP 0x04
+#define FLAG_PRELOAD_NAMES 0x08
+#define FLAG_RECURSIVE 0x10
 
 #define COLOR_NORMAL 0
 #define COLOR_FOLDER 1
 #define COLOR_EXE 2
 #define COLOR_LINK 3
 
-#define PATH_BUFFER_SIZE 4096
+#define DIRENT_BATCH_SIZE (256 * 1024)   // bytes of getdents64() records per call
+#define INITIAL_RECORD_COUNT 256
+#define INITIAL_NAME_BYTES (16 * 1024)
+#define MAX_STAT_WORKERS 256
+#define STAT_CLAIM_SIZE 64                // entries a worker takes at a time
+#define NAME_CACHE_INITIAL_SLOTS 64       // a power of two
+#define NAME_LINE_SIZE 1024
+#define TREE_OUTPUT_LIMIT (4 * 1024 * 1024)  // -R: rendered bytes walkers may keep ahead of the printer
 
 static const int color_codes[] = {39, 34, 32, 36};
-static const char *option_str = "hla";
+static const char *option_str = "hlaPRj:";
 static const char *perm_chars = "rwx";
 static const char *reset_seq = "\x1b[0m";
 static const char *color_seq = "\x1b[";
@@ -34,25 +46,138 @@ static const mode_t perm_flags[] = {
         S_IROTH, S_IWOTH, S_IXOTH
 };
 
+// One directory entry; its name lives in the arena's name block
 typedef struct {
-    char *buffer;
-    const char *location;
-    DIR *stream;
+    uint64_t inode;
+    uint32_t name_offset;
+    uint16_t name_length;
+    unsigned char type;     // d_type, DT_UNKNOWN if the file system does not say
+} EntryRecord;
+
+// Every entry of a listing in two growing blocks, released in one go
+typedef struct {
+    EntryRecord *records;
+    size_t count;
+    size_t capacity;
+    char *names;            // NUL-terminated names, back to back
+    size_t names_used;
+    size_t names_capacity;
+} EntryArena;
+
+// What a listing shows of an inode
+typedef struct {
+    mode_t mode;
+    nlink_t nlink;
+    uid_t uid;
+    gid_t gid;
+    off_t size;
+    time_t mtime;
+    int error;              // errno of a failed lookup, 0 otherwise
+} EntryInfo;
+
+typedef struct {
+    unsigned int id;
+    int used;
+    char *name;             // NULL if the id has no name
+} NameSlot;
+
+// uid or gid -> name, each id resolved once per run (open addressing)
+typedef struct {
+    NameSlot *slots;
+    size_t capacity;
     size_t count;
-    struct dirent **list;
+} NameCache;
+
+// Everything needed to read, look up and print one directory, so that
+// any number of them can be in flight on different threads
+typedef struct DirListing {
+    char *path;
+    int dir_fd;             // entries are looked up relative to it
+    EntryArena entries;
+    EntryInfo *infos;       // per entry, looked up ahead by -j workers; NULL otherwise
+    size_t next_lookup;     // first entry no worker has claimed yet
+    char *output;           // -R: the rendered section, until the printer gets to it
+    size_t output_length;
+    int error;              // errno of the failure that cut the listing short
+    struct DirListing **children;   // -R: subdirectories, in listing order
+    size_t child_count;
+    size_t child_capacity;
+    int done;               // -R: a walker is finished with it; under the walk lock
+} DirListing;
+
+// A walker's own directories: it takes from the bottom, thieves from the top
+typedef struct {
+    DirListing **items;
+    size_t top;
+    size_t bottom;
+    size_t capacity;
+} WorkDeque;
+
+typedef struct {
+    WorkDeque *deques;      // one per walker
+    long walker_count;
+    size_t pending;         // directories queued or being read
+    size_t buffered;        // rendered bytes of finished directories not printed yet
+    pthread_mutex_t lock;   // guards the deques, pending, buffered and every done flag
+    pthread_cond_t changed; // a directory was queued, finished or printed
+} TreeWalk;
+
+typedef struct {
+    TreeWalk *walk;
+    long index;
+    char *batch;
+} WalkerArg;
+
+typedef struct {
+    char *batch;            // DIRENT_BATCH_SIZE bytes for getdents64()
+    DirListing *listing;    // the directory being listed without -R
+    long workers;
+    NameCache users;
+    NameCache groups;
+    pthread_mutex_t names_lock;     // -R walkers share the name caches
     unsigned char flags;
 } AppData;
 
-AppData app = {0};
+AppData app = {.workers = 1, .names_lock = PTHREAD_MUTEX_INITIALIZER};
 
 void init_app();
 void cleanup_app();
 void report_error(int code);
-void build_full_path(const char *name);
-void load_directory_entries();
-void display_entry(struct dirent *entry);
+void init_listing(DirListing *listing, char *path);
+void release_listing(DirListing *listing);
+int load_directory_entries(DirListing *listing, char *batch);
+int arena_add_entry(EntryArena *arena, const struct dirent64 *entry);
+void release_arena(EntryArena *arena);
+const char *entry_name(const EntryArena *entries, const EntryRecord *entry);
+int entry_shown(const char *name);
+int entry_needs_info(const EntryArena *entries, const EntryRecord *entry);
+unsigned int entry_info_mask();
+int fetch_entry_info(int dir_fd, const char *name, unsigned int mask, EntryInfo *info);
+int resolve_entry_info(DirListing *listing, size_t index, EntryInfo *info);
+void *lookup_worker(void *arg);
+void prefetch_entry_info(DirListing *listing);
+NameSlot *name_cache_slot(NameCache *cache, unsigned int id);
+void name_cache_store(NameCache *cache, unsigned int id, const char *name);
+void preload_name_cache(NameCache *cache, const char *path);
+void release_name_cache(NameCache *cache);
+char *lookup_user_name(unsigned int uid);
+char *lookup_group_name(unsigned int gid);
+const char *cached_name(NameCache *cache, unsigned int id, char *(*lookup)(unsigned int));
+const char *user_name(uid_t uid);
+const char *group_name(gid_t gid);
+void display_entry(DirListing *listing, const EntryRecord *entry, const EntryInfo *info, FILE *out);
+int render_listing(DirListing *listing, FILE *out);
+int add_child_listing(DirListing *listing, const char *name);
 void process_directory(const char *target);
-int entry_sorter(const void *a, const void *b);
+void push_listing(TreeWalk *walk, long index, DirListing *listing);
+DirListing *take_listing(TreeWalk *walk, long index);
+int unqueue_listing(TreeWalk *walk, DirListing *listing);
+void walk_listing(DirListing *listing, char *batch);
+void finish_listing(TreeWalk *walk, long index, DirListing *listing);
+void *tree_walker(void *arg);
+int print_tree(TreeWalk *walk, DirListing *listing, int first);
+int process_tree(const char *target);
+int entry_sorter(const void *a, const void *b, void *names);
 
 int main(int argc, char **argv) {
     init_app();
@@ -67,6 +192,9 @@ int main(int argc, char **argv) {
                        "Options:\n"
                        "  -a  Include hidden entries\n"
                        "  -l  Detailed view\n"
+                       "  -R  List subdirectories recursively\n"
+                       "  -j N  Look entries up on N threads, with -R walk on N threads (0: one per CPU)\n"
+                       "  -P  Preload owner names from /etc/passwd and /etc/group\n"
                        "  -h  Display help\n", argv[0]);
                 cleanup_app();
                 return 0;
@@ -76,6 +204,30 @@ int main(int argc, char **argv) {
             case 'a':
                 app.flags |= FLAG_ALL;
                 break;
+            case 'P':
+                app.flags |= FLAG_PRELOAD_NAMES;
+                break;
+            case 'R':
+                app.flags |= FLAG_RECURSIVE;
+                break;
+            case 'j': {
+                char *number_end;
+                app.workers = strtol(optarg, &number_end, 10);
+                if (*number_end != '\0' || app.workers < 0 || app.workers > MAX_STAT_WORKERS) {
+                    fprintf(stderr, "Error: Invalid thread count '%s'\n", optarg);
+                    cleanup_app();
+                    return 1;
+                }
+                if (app.workers == 0) {
+                    app.workers = sysconf(_SC_NPROCESSORS_ONLN);
+                    if (app.workers < 1) {
+                        app.workers = 1;
+                    } else if (app.workers > MAX_STAT_WORKERS) {
+                        app.workers = MAX_STAT_WORKERS;
+                    }
+                }
+                break;
+            }
             case '?':
                 report_error(1);
                 break;
@@ -88,36 +240,41 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if ((app.flags & FLAG_PRELOAD_NAMES) && (app.flags & FLAG_LONG)) {
+        preload_name_cache(&app.users, "/etc/passwd");
+        preload_name_cache(&app.groups, "/etc/group");
+    }
+
     const char *target = (optind == argc) ? "." : argv[optind];
-    process_directory(target);
+    int status = 0;
+    if (app.flags & FLAG_RECURSIVE) {
+        status = process_tree(target);
+    } else {
+        process_directory(target);
+    }
     cleanup_app();
-    return 0;
+    return status;
 }
 
 void init_app() {
-    app.buffer = (char *)malloc(PATH_BUFFER_SIZE);
-    if (!app.buffer) {
+    app.batch = (char *)malloc(DIRENT_BATCH_SIZE);
+    if (!app.batch) {
         fprintf(stderr, "Memory allocation failure\n");
         exit(1);
     }
 }
 
 void cleanup_app() {
-    if (app.buffer) {
-        free(app.buffer);
-        app.buffer = NULL;
-    }
-    if (app.stream) {
-        closedir(app.stream);
-        app.stream = NULL;
+    if (app.batch) {
+        free(app.batch);
+        app.batch = NULL;
     }
-    if (app.list) {
-        for (size_t i = 0; i < app.count; i++) {
-            free(app.list[i]);
-        }
-        free(app.list);
-        app.list = NULL;
+    if (app.listing) {
+        release_listing(app.listing);
+        app.listing = NULL;
     }
+    release_name_cache(&app.users);
+    release_name_cache(&app.groups);
 }
 
 void report_error(int code) {
@@ -149,202 +306,814 @@ void report_error(int code) {
     exit(1);
 }
 
-void build_full_path(const char *name) {
-    if (!app.location) {
-        app.location = ".";
-    }
+// The listing takes over path, which must come from malloc()
+void init_listing(DirListing *listing, char *path) {
+    memset(listing, 0, sizeof(*listing));
+    listing->path = path;
+    listing->dir_fd = -1;
+}
 
-    int len = snprintf(app.buffer, PATH_BUFFER_SIZE, "%s/%s",
-                       app.location, name);
-    if (len < 0 || (size_t)len >= PATH_BUFFER_SIZE) {
-        fprintf(stderr, "Path exceeds maximum length\n");
-        cleanup_app();
-        exit(1);
+// Frees what the listing holds, but not the listing itself or its children
+void release_listing(DirListing *listing) {
+    if (listing->dir_fd != -1) {
+        close(listing->dir_fd);
+        listing->dir_fd = -1;
     }
+    release_arena(&listing->entries);
+    free(listing->infos);
+    free(listing->output);
+    free(listing->children);
+    free(listing->path);
+    listing->infos = NULL;
+    listing->output = NULL;
+    listing->children = NULL;
+    listing->path = NULL;
 }
 
-void load_directory_entries() {
-    struct dirent *current;
-    size_t capacity = 32;
+// getdents64() hands over a whole batch of entries per system call; they
+// are packed into the arena without a malloc() per entry.
+// Returns 0, or -1 with errno set.
+int load_directory_entries(DirListing *listing, char *batch) {
+    listing->entries.count = 0;
+    listing->entries.names_used = 0;
 
-    app.list = (struct dirent **)malloc(capacity * sizeof(struct dirent *));
-    if (!app.list) {
-        report_error(3);
+    for (;;) {
+        ssize_t bytes_read = getdents64(listing->dir_fd, batch, DIRENT_BATCH_SIZE);
+        if (bytes_read < 0) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+
+        for (ssize_t offset = 0; offset < bytes_read;) {
+            const struct dirent64 *entry = (const struct dirent64 *)(batch + offset);
+            if (arena_add_entry(&listing->entries, entry) != 0) {
+                return -1;
+            }
+            offset += entry->d_reclen;
+        }
     }
 
-    app.count = 0;
-    errno = 0;
+    qsort_r(listing->entries.records, listing->entries.count, sizeof(EntryRecord), entry_sorter,
+            listing->entries.names);
+    return 0;
+}
+
+int arena_add_entry(EntryArena *arena, const struct dirent64 *entry) {
+    size_t name_length = strlen(entry->d_name);
 
-    while ((current = readdir(app.stream)) != NULL) {
-        if (app.count >= capacity) {
+    if (arena->count == arena->capacity) {
+        size_t capacity = arena->capacity ? arena->capacity * 2 : INITIAL_RECORD_COUNT;
+        EntryRecord *records = (EntryRecord *)realloc(arena->records, capacity * sizeof(EntryRecord));
+        if (!records) {
+            return -1;
+        }
+        arena->records = records;
+        arena->capacity = capacity;
+    }
+
+    // Names are addressed by offset, so the block may move when it grows
+    if (arena->names_capacity - arena->names_used < name_length + 1) {
+        size_t capacity = arena->names_capacity ? arena->names_capacity : INITIAL_NAME_BYTES;
+        while (capacity - arena->names_used < name_length + 1) {
             capacity *= 2;
-            struct dirent **new_list = (struct dirent **)realloc(
-                    app.list, capacity * sizeof(struct dirent *));
-            if (!new_list) {
-                for (size_t i = 0; i < app.count; i++) {
-                    free(app.list[i]);
-                }
-                free(app.list);
-                app.list = NULL;
-                report_error(3);
-            }
-            app.list = new_list;
         }
+        if (capacity > UINT32_MAX) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+        char *names = (char *)realloc(arena->names, capacity);
+        if (!names) {
+            return -1;
+        }
+        arena->names = names;
+        arena->names_capacity = capacity;
+    }
 
-        struct dirent *copy = (struct dirent *)malloc(sizeof(struct dirent));
-        if (!copy) {
-            for (size_t i = 0; i < app.count; i++) {
-                free(app.list[i]);
+    EntryRecord *record = &arena->records[arena->count++];
+    record->inode = entry->d_ino;
+    record->name_offset = (uint32_t)arena->names_used;
+    record->name_length = (uint16_t)name_length;
+    record->type = entry->d_type;
+
+    memcpy(arena->names + arena->names_used, entry->d_name, name_length + 1);
+    arena->names_used += name_length + 1;
+    return 0;
+}
+
+void release_arena(EntryArena *arena) {
+    free(arena->records);
+    free(arena->names);
+    memset(arena, 0, sizeof(*arena));
+}
+
+const char *entry_name(const EntryArena *entries, const EntryRecord *entry) {
+    return entries->names + entry->name_offset;
+}
+
+int entry_shown(const char *name) {
+    return name[0] != '.' || (app.flags & FLAG_ALL);
+}
+
+// Hidden entries are not shown; in short mode d_type already tells
+// directories and links apart, only the execute bits of everything else
+// need a look at the inode
+int entry_needs_info(const EntryArena *entries, const EntryRecord *entry) {
+    if (!entry_shown(entry_name(entries, entry))) {
+        return 0;
+    }
+    return (app.flags & FLAG_LONG) || (entry->type != DT_DIR && entry->type != DT_LNK);
+}
+
+unsigned int entry_info_mask() {
+    if (app.flags & FLAG_LONG) {
+        return STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+    }
+    return STATX_TYPE | STATX_MODE;
+}
+
+// The slot holding id, or the empty slot where it belongs
+NameSlot *name_cache_slot(NameCache *cache, unsigned int id) {
+    size_t mask = cache->capacity - 1;
+    size_t index = (id * 2654435761u) & mask;
+
+    while (cache->slots[index].used && cache->slots[index].id != id) {
+        index = (index + 1) & mask;
+    }
+    return &cache->slots[index];
+}
+
+void name_cache_store(NameCache *cache, unsigned int id, const char *name) {
+    // Kept at most half full, so probe sequences stay short
+    if ((cache->count + 1) * 2 > cache->capacity) {
+        NameCache grown = {NULL, cache->capacity ? cache->capacity * 2 : NAME_CACHE_INITIAL_SLOTS, 0};
+        grown.slots = (NameSlot *)calloc(grown.capacity, sizeof(NameSlot));
+        if (!grown.slots) {
+            report_error(5);
+        }
+        for (size_t i = 0; i < cache->capacity; i++) {
+            if (cache->slots[i].used) {
+                *name_cache_slot(&grown, cache->slots[i].id) = cache->slots[i];
+                grown.count++;
             }
-            free(app.list);
-            app.list = NULL;
-            report_error(3);
         }
-        memcpy(copy, current, sizeof(struct dirent));
-        app.list[app.count++] = copy;
+        free(cache->slots);
+        *cache = grown;
     }
 
-    if (errno) {
-        for (size_t i = 0; i < app.count; i++) {
-            free(app.list[i]);
+    NameSlot *slot = name_cache_slot(cache, id);
+    if (slot->used) {
+        return;
+    }
+    slot->id = id;
+    slot->used = 1;
+    slot->name = name ? strdup(name) : NULL;
+    if (name && !slot->name) {
+        report_error(5);
+    }
+    cache->count++;
+}
+
+// Read "name:password:id:..." lines, as /etc/passwd and /etc/group have
+// them, so that local ids never reach NSS. As with the files backend,
+// the first line for an id wins. Ids missing here are still looked up.
+void preload_name_cache(NameCache *cache, const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[NAME_LINE_SIZE];
+
+    if (!file) {
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        char *name_end = strchr(line, ':');
+        char *id_start = name_end ? strchr(name_end + 1, ':') : NULL;
+        if (!id_start || line[0] == '+' || line[0] == '-') {
+            continue;
         }
-        free(app.list);
-        app.list = NULL;
-        report_error(3);
+
+        char *id_end;
+        unsigned long id = strtoul(id_start + 1, &id_end, 10);
+        if (id_end == id_start + 1 || *id_end != ':' || id > UINT_MAX) {
+            continue;
+        }
+        *name_end = '\0';
+        name_cache_store(cache, (unsigned int)id, line);
     }
+    fclose(file);
+}
 
-    qsort(app.list, app.count, sizeof(struct dirent *), entry_sorter);
+void release_name_cache(NameCache *cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        free(cache->slots[i].name);
+    }
+    free(cache->slots);
+    memset(cache, 0, sizeof(*cache));
 }
 
-void display_entry(struct dirent *entry) {
-    if (entry->d_name[0] == '.' && !(app.flags & FLAG_ALL)) {
-        free(entry);
-        return;
+// getpwuid_r() with a buffer grown until the entry fits.
+// Returns the name in malloc'd memory, NULL if the id has none.
+char *lookup_user_name(unsigned int uid) {
+    size_t size = NAME_LINE_SIZE;
+
+    for (;;) {
+        char *buffer = (char *)malloc(size);
+        struct passwd entry;
+        struct passwd *user = NULL;
+        if (!buffer) {
+            report_error(5);
+        }
+        if (getpwuid_r((uid_t)uid, &entry, buffer, size, &user) == ERANGE) {
+            free(buffer);
+            size *= 2;
+            continue;
+        }
+        char *name = user ? strdup(user->pw_name) : NULL;
+        free(buffer);
+        if (user && !name) {
+            report_error(5);
+        }
+        return name;
     }
+}
 
-    build_full_path(entry->d_name);
-    int color_idx = COLOR_NORMAL;
-    struct stat info;
+// getgrgid_r() the same way; a group's member list can be long
+char *lookup_group_name(unsigned int gid) {
+    size_t size = NAME_LINE_SIZE;
 
-    if (lstat(app.buffer, &info) == -1) {
-        free(entry);
-        report_error(4);
+    for (;;) {
+        char *buffer = (char *)malloc(size);
+        struct group entry;
+        struct group *grp = NULL;
+        if (!buffer) {
+            report_error(5);
+        }
+        if (getgrgid_r((gid_t)gid, &entry, buffer, size, &grp) == ERANGE) {
+            free(buffer);
+            size *= 2;
+            continue;
+        }
+        char *name = grp ? strdup(grp->gr_name) : NULL;
+        free(buffer);
+        if (grp && !name) {
+            report_error(5);
+        }
+        return name;
     }
+}
+
+// The names lock only guards the cache: a lookup that goes to NSS (LDAP,
+// sssd) can take long, and other -R walkers go on meanwhile. Two walkers
+// may look the same id up at once; the first to store it wins.
+const char *cached_name(NameCache *cache, unsigned int id, char *(*lookup)(unsigned int)) {
+    const char *name;
+
+    pthread_mutex_lock(&app.names_lock);
+    NameSlot *slot = cache->capacity ? name_cache_slot(cache, id) : NULL;
+    if (slot && slot->used) {
+        name = slot->name;
+        pthread_mutex_unlock(&app.names_lock);
+        return name;
+    }
+    pthread_mutex_unlock(&app.names_lock);
+
+    char *found = lookup(id);
+
+    pthread_mutex_lock(&app.names_lock);
+    name_cache_store(cache, id, found);
+    name = name_cache_slot(cache, id)->name;
+    pthread_mutex_unlock(&app.names_lock);
+    free(found);
+    // The string stays put when the cache grows; only its slot moves
+    return name;
+}
+
+const char *user_name(uid_t uid) {
+    return cached_name(&app.users, uid, lookup_user_name);
+}
+
+const char *group_name(gid_t gid) {
+    return cached_name(&app.groups, gid, lookup_group_name);
+}
+
+void display_entry(DirListing *listing, const EntryRecord *entry, const EntryInfo *info, FILE *out) {
+    const char *name = entry_name(&listing->entries, entry);
+    int color_idx = COLOR_NORMAL;
 
     if (app.flags & FLAG_LONG) {
+
         char type_sym = '?';
-        if (S_ISREG(info.st_mode)) {
+        if (S_ISREG(info->mode)) {
             type_sym = '-';
-            if (info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) {
+            if (info->mode & (S_IXUSR | S_IXGRP | S_IXOTH)) {
                 color_idx = COLOR_EXE;
             }
-        } else if (S_ISDIR(info.st_mode)) {
+        } else if (S_ISDIR(info->mode)) {
             type_sym = 'd';
             color_idx = COLOR_FOLDER;
-        } else if (S_ISCHR(info.st_mode)) {
+        } else if (S_ISCHR(info->mode)) {
             type_sym = 'c';
-        } else if (S_ISBLK(info.st_mode)) {
+        } else if (S_ISBLK(info->mode)) {
             type_sym = 'b';
-        } else if (S_ISFIFO(info.st_mode)) {
+        } else if (S_ISFIFO(info->mode)) {
             type_sym = 'p';
-        } else if (S_ISLNK(info.st_mode)) {
+        } else if (S_ISLNK(info->mode)) {
             type_sym = 'l';
             color_idx = COLOR_LINK;
-        } else if (S_ISSOCK(info.st_mode)) {
+        } else if (S_ISSOCK(info->mode)) {
             type_sym = 's';
         }
 
-        putchar(type_sym);
+        fputc(type_sym, out);
 
-        mode_t perms = info.st_mode;
+        mode_t perms = info->mode;
         for (int i = 0; i < 9; i++) {
-            putchar(perms & perm_flags[i] ? perm_chars[i % 3] : '-');
+            fputc(perms & perm_flags[i] ? perm_chars[i % 3] : '-', out);
         }
-        putchar(' ');
+        fputc(' ', out);
 
-        printf("%lu ", (unsigned long)info.st_nlink);
+        fprintf(out, "%lu ", (unsigned long)info->nlink);
 
-        struct passwd *user = getpwuid(info.st_uid);
+        const char *user = user_name(info->uid);
         if (user) {
-            printf("%-8s ", user->pw_name);
+            fprintf(out, "%-8s ", user);
         } else {
-            printf("%-8u ", (unsigned)info.st_uid);
+            fprintf(out, "%-8u ", (unsigned)info->uid);
         }
 
-        struct group *grp = getgrgid(info.st_gid);
+        const char *grp = group_name(info->gid);
         if (grp) {
-            printf("%-8s ", grp->gr_name);
+            fprintf(out, "%-8s ", grp);
         } else {
-            printf("%-8u ", (unsigned)info.st_gid);
+            fprintf(out, "%-8u ", (unsigned)info->gid);
         }
 
-        if (S_ISCHR(info.st_mode) || S_ISBLK(info.st_mode)) {
-            printf("%8lld ", (long long)info.st_size);
+        if (S_ISCHR(info->mode) || S_ISBLK(info->mode)) {
+            fprintf(out, "%8lld ", (long long)info->size);
         } else {
-            printf("%8lld ", (long long)info.st_size);
+            fprintf(out, "%8lld ", (long long)info->size);
         }
 
         char time_buf[64];
-        struct tm *tm_ptr = localtime(&info.st_mtime);
-        strftime(time_buf, sizeof(time_buf), "%b %d %H:%M", tm_ptr);
-        printf("%s ", time_buf);
+        struct tm local_time;
+        localtime_r(&info->mtime, &local_time);
+        strftime(time_buf, sizeof(time_buf), "%b %d %H:%M", &local_time);
+        fprintf(out, "%s ", time_buf);
 
-        printf("%s%dm%s%s", color_seq, color_codes[color_idx],
-               entry->d_name, reset_seq);
+        fprintf(out, "%s%dm%s%s", color_seq, color_codes[color_idx],
+                name, reset_seq);
 
-        if (S_ISLNK(info.st_mode)) {
+        if (S_ISLNK(info->mode)) {
             char link_path[PATH_MAX];
-            ssize_t link_len = readlink(app.buffer, link_path, sizeof(link_path) - 1);
+            ssize_t link_len = readlinkat(listing->dir_fd, name, link_path, sizeof(link_path) - 1);
             if (link_len != -1) {
                 link_path[link_len] = '\0';
-                printf(" -> %s", link_path);
+                fprintf(out, " -> %s", link_path);
             }
         }
-        printf("\n");
+        fputc('\n', out);
     } else {
-        if (S_ISDIR(info.st_mode)) {
+        if (S_ISDIR(info->mode)) {
             color_idx = COLOR_FOLDER;
-        } else if (S_ISLNK(info.st_mode)) {
+        } else if (S_ISLNK(info->mode)) {
             color_idx = COLOR_LINK;
-        } else if (info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) {
+        } else if (info->mode & (S_IXUSR | S_IXGRP | S_IXOTH)) {
             color_idx = COLOR_EXE;
         }
 
-        printf("%s%dm%-20s%s", color_seq, color_codes[color_idx],
-               entry->d_name, reset_seq);
+        fprintf(out, "%s%dm%-20s%s", color_seq, color_codes[color_idx],
+                name, reset_seq);
+    }
+}
+
+// statx() fetches just the fields in mask, relative to the directory, so
+// there is no path to build and walk; kernels without it get fstatat().
+// Safe to call from any thread. Returns 0, or -1 with info->error set.
+int fetch_entry_info(int dir_fd, const char *name, unsigned int mask, EntryInfo *info) {
+    struct statx extended;
+    struct stat basic;
+
+    info->error = 0;
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &extended) == 0) {
+        info->mode = extended.stx_mode;
+        info->nlink = extended.stx_nlink;
+        info->uid = extended.stx_uid;
+        info->gid = extended.stx_gid;
+        info->size = (off_t)extended.stx_size;
+        info->mtime = extended.stx_mtime.tv_sec;
+        return 0;
+    }
+    if (errno != ENOSYS || fstatat(dir_fd, name, &basic, AT_SYMLINK_NOFOLLOW) == -1) {
+        info->error = errno;
+        return -1;
+    }
+
+    info->mode = basic.st_mode;
+    info->nlink = basic.st_nlink;
+    info->uid = basic.st_uid;
+    info->gid = basic.st_gid;
+    info->size = basic.st_size;
+    info->mtime = basic.st_mtime;
+    return 0;
+}
+
+// What display_entry() needs of a shown entry: prefetched, looked up now,
+// or for directories and links in short mode just d_type.
+// Returns 0, or -1 with errno set.
+int resolve_entry_info(DirListing *listing, size_t index, EntryInfo *info) {
+    const EntryRecord *entry = &listing->entries.records[index];
+
+    if (!entry_needs_info(&listing->entries, entry)) {
+        info->mode = DTTOIF(entry->type);
+        return 0;
+    }
+    if (listing->infos) {
+        *info = listing->infos[index];
+    } else {
+        fetch_entry_info(listing->dir_fd, entry_name(&listing->entries, entry), entry_info_mask(), info);
+    }
+    if (info->error) {
+        errno = info->error;
+        return -1;
+    }
+    return 0;
+}
+
+void *lookup_worker(void *arg) {
+    DirListing *listing = (DirListing *)arg;
+
+    for (;;) {
+        size_t start = __atomic_fetch_add(&listing->next_lookup, STAT_CLAIM_SIZE, __ATOMIC_RELAXED);
+        if (start >= listing->entries.count) {
+            break;
+        }
+
+        size_t end = start + STAT_CLAIM_SIZE;
+        if (end > listing->entries.count) {
+            end = listing->entries.count;
+        }
+        for (size_t i = start; i < end; i++) {
+            const EntryRecord *entry = &listing->entries.records[i];
+            if (entry_needs_info(&listing->entries, entry)) {
+                fetch_entry_info(listing->dir_fd, entry_name(&listing->entries, entry), entry_info_mask(),
+                                 &listing->infos[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+// On slow or cold storage the lookups are latency-bound: with -j they are
+// all issued at once from a pool of threads, before anything is printed.
+// Failures are kept per entry and reported in listing order, as without -j.
+void prefetch_entry_info(DirListing *listing) {
+    pthread_t threads[MAX_STAT_WORKERS];
+    long started = 0;
+
+    listing->infos = (EntryInfo *)malloc(listing->entries.count * sizeof(EntryInfo));
+    if (!listing->infos) {
+        return;
+    }
+    listing->next_lookup = 0;
+
+    // The calling thread is one of the workers
+    while (started < app.workers - 1 && (size_t)started * STAT_CLAIM_SIZE < listing->entries.count) {
+        if (pthread_create(&threads[started], NULL, lookup_worker, listing) != 0) {
+            break;
+        }
+        started++;
+    }
+    lookup_worker(listing);
+
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Prints the entries of a loaded listing; with -R it also collects the
+// subdirectories to descend into. Returns 0, or -1 with errno set when an
+// entry could not be looked up or remembered, leaving the rest unprinted.
+int render_listing(DirListing *listing, FILE *out) {
+    for (size_t i = 0; i < listing->entries.count; i++) {
+        const EntryRecord *entry = &listing->entries.records[i];
+        const char *name = entry_name(&listing->entries, entry);
+        EntryInfo info;
+
+        if (!entry_shown(name)) {
+            continue;
+        }
+        if (resolve_entry_info(listing, i, &info) != 0) {
+            return -1;
+        }
+        display_entry(listing, entry, &info, out);
+
+        // lstat() semantics: links to directories are not followed
+        if ((app.flags & FLAG_RECURSIVE) && S_ISDIR(info.mode) &&
+            strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            if (add_child_listing(listing, name) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    if (!(app.flags & FLAG_LONG)) {
+        fputc('\n', out);
+    }
+    return 0;
+}
+
+int add_child_listing(DirListing *listing, const char *name) {
+    if (listing->child_count == listing->child_capacity) {
+        size_t capacity = listing->child_capacity ? listing->child_capacity * 2 : 16;
+        DirListing **children = (DirListing **)realloc(listing->children, capacity * sizeof(DirListing *));
+        if (!children) {
+            return -1;
+        }
+        listing->children = children;
+        listing->child_capacity = capacity;
+    }
+
+    size_t path_length = strlen(listing->path);
+    const char *separator = (path_length > 0 && listing->path[path_length - 1] == '/') ? "" : "/";
+    char *path;
+    if (asprintf(&path, "%s%s%s", listing->path, separator, name) == -1) {
+        return -1;
     }
 
-    free(entry);
+    DirListing *child = (DirListing *)malloc(sizeof(DirListing));
+    if (!child) {
+        free(path);
+        return -1;
+    }
+    init_listing(child, path);
+    listing->children[listing->child_count++] = child;
+    return 0;
 }
 
 void process_directory(const char *target) {
-    app.stream = opendir(target);
-    if (!app.stream) {
+    DirListing listing;
+
+    char *path = strdup(target);
+    if (!path) {
+        report_error(5);
+    }
+    init_listing(&listing, path);
+    app.listing = &listing;
+
+    listing.dir_fd = open(target, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (listing.dir_fd == -1) {
         report_error(2);
     }
 
-    app.location = target;
-    load_directory_entries();
+    if (load_directory_entries(&listing, app.batch) != 0) {
+        report_error(3);
+    }
+    if (app.workers > 1) {
+        prefetch_entry_info(&listing);
+    }
 
-    for (size_t i = 0; i < app.count; i++) {
-        display_entry(app.list[i]);
+    if (render_listing(&listing, stdout) != 0) {
+        report_error(4);
     }
 
-    app.count = 0;
-    free(app.list);
-    app.list = NULL;
+    release_listing(&listing);
+    app.listing = NULL;
+}
 
-    if (!(app.flags & FLAG_LONG)) {
+// Recursive listing. Every walker reads, sorts, looks up and renders whole
+// directories into memory, then queues their subdirectories on its own
+// deque. It takes its newest directory first, so it stays deep in the part
+// of the tree the printer wants next; an idle walker steals the oldest
+// directory of another, which tends to be the root of a large subtree.
+// The main thread prints the sections in the order ls -R has them, each
+// as soon as it and everything before it are done. Walkers stop taking
+// directories while TREE_OUTPUT_LIMIT bytes wait for the printer; the
+// printer reads a directory it needs itself if no walker has taken it.
+void push_listing(TreeWalk *walk, long index, DirListing *listing) {
+    WorkDeque *deque = &walk->deques[index];
+
+    if (deque->bottom == deque->capacity) {
+        if (deque->top > 0) {
+            memmove(deque->items, deque->items + deque->top, (deque->bottom - deque->top) * sizeof(DirListing *));
+            deque->bottom -= deque->top;
+            deque->top = 0;
+        }
+        if (deque->bottom == deque->capacity) {
+            size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+            DirListing **items = (DirListing **)realloc(deque->items, capacity * sizeof(DirListing *));
+            if (!items) {
+                report_error(5);
+            }
+            deque->items = items;
+            deque->capacity = capacity;
+        }
+    }
+    deque->items[deque->bottom++] = listing;
+}
+
+// Called with the walk lock held; waits for work, NULL once the tree is done
+DirListing *take_listing(TreeWalk *walk, long index) {
+    for (;;) {
+        WorkDeque *own = &walk->deques[index];
+        if (walk->buffered < TREE_OUTPUT_LIMIT && own->bottom > own->top) {
+            return own->items[--own->bottom];
+        }
+        for (long i = 1; i < walk->walker_count && walk->buffered < TREE_OUTPUT_LIMIT; i++) {
+            WorkDeque *victim = &walk->deques[(index + i) % walk->walker_count];
+            if (victim->bottom > victim->top) {
+                return victim->items[victim->top++];
+            }
+        }
+        if (walk->pending == 0) {
+            return NULL;
+        }
+        pthread_cond_wait(&walk->changed, &walk->lock);
+    }
+}
+
+// Called with the walk lock held; takes a queued directory off its deque.
+// Returns 1 if it was queued, 0 if a walker has it already.
+int unqueue_listing(TreeWalk *walk, DirListing *listing) {
+    for (long i = 0; i < walk->walker_count; i++) {
+        WorkDeque *deque = &walk->deques[i];
+        // Newest first: the printer usually wants what was just queued
+        for (size_t j = deque->bottom; j > deque->top; j--) {
+            if (deque->items[j - 1] == listing) {
+                memmove(deque->items + j - 1, deque->items + j, (deque->bottom - j) * sizeof(DirListing *));
+                deque->bottom--;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// A failure ends the directory's section early and is kept for the printer
+void walk_listing(DirListing *listing, char *batch) {
+    FILE *out = open_memstream(&listing->output, &listing->output_length);
+    if (!out) {
+        listing->error = errno;
+        return;
+    }
+
+    listing->dir_fd = open(listing->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (listing->dir_fd == -1 || load_directory_entries(listing, batch) != 0 ||
+        render_listing(listing, out) != 0) {
+        listing->error = errno;
+    }
+    if (fclose(out) != 0 && !listing->error) {
+        listing->error = errno;
+    }
+
+    if (listing->dir_fd != -1) {
+        close(listing->dir_fd);
+        listing->dir_fd = -1;
+    }
+    release_arena(&listing->entries);
+}
+
+// The children go on the deque last first, so the first comes off next
+void finish_listing(TreeWalk *walk, long index, DirListing *listing) {
+    pthread_mutex_lock(&walk->lock);
+    for (size_t i = listing->child_count; i > 0; i--) {
+        push_listing(walk, index, listing->children[i - 1]);
+    }
+    walk->pending += listing->child_count;
+    walk->pending--;
+    walk->buffered += listing->output_length;
+    listing->done = 1;
+    pthread_cond_broadcast(&walk->changed);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+void *tree_walker(void *arg) {
+    WalkerArg *walker = (WalkerArg *)arg;
+    TreeWalk *walk = walker->walk;
+
+    for (;;) {
+        pthread_mutex_lock(&walk->lock);
+        DirListing *listing = take_listing(walk, walker->index);
+        pthread_mutex_unlock(&walk->lock);
+        if (!listing) {
+            break;
+        }
+
+        walk_listing(listing, walker->batch);
+        finish_listing(walk, walker->index, listing);
+    }
+    return NULL;
+}
+
+// Depth first, in listing order; frees every listing once it is printed.
+// Returns 1 if any directory of the subtree failed, 0 otherwise.
+int print_tree(TreeWalk *walk, DirListing *listing, int first) {
+    int status = 0;
+
+    pthread_mutex_lock(&walk->lock);
+    if (!listing->done && unqueue_listing(walk, listing)) {
+        pthread_mutex_unlock(&walk->lock);
+        walk_listing(listing, app.batch);
+        finish_listing(walk, 0, listing);
+        pthread_mutex_lock(&walk->lock);
+    }
+    while (!listing->done) {
+        pthread_cond_wait(&walk->changed, &walk->lock);
+    }
+    pthread_mutex_unlock(&walk->lock);
+
+    if (!first) {
         putchar('\n');
     }
+    printf("%s:\n", listing->path);
+    fwrite(listing->output, 1, listing->output_length, stdout);
+    if (listing->error) {
+        fflush(stdout);
+        fprintf(stderr, "Operation failed: %s: %s\n", listing->path, strerror(listing->error));
+        status = 1;
+    }
+
+    // The section is gone before the subtree is printed
+    free(listing->output);
+    listing->output = NULL;
+
+    pthread_mutex_lock(&walk->lock);
+    int was_full = (walk->buffered >= TREE_OUTPUT_LIMIT);
+    walk->buffered -= listing->output_length;
+    if (was_full && walk->buffered < TREE_OUTPUT_LIMIT) {
+        pthread_cond_broadcast(&walk->changed);
+    }
+    pthread_mutex_unlock(&walk->lock);
+
+    for (size_t i = 0; i < listing->child_count; i++) {
+        status |= print_tree(walk, listing->children[i], 0);
+    }
+    release_listing(listing);
+    free(listing);
+    return status;
+}
+
+// A directory that cannot be read is reported in its place and the walk
+// goes on; the exit status tells that something was left out
+int process_tree(const char *target) {
+    TreeWalk walk = {.walker_count = app.workers};
+    pthread_t threads[MAX_STAT_WORKERS];
+    WalkerArg walkers[MAX_STAT_WORKERS];
+    long started = 0;
+
+    // The thread arrays hold MAX_STAT_WORKERS, whatever app.workers says
+    if (walk.walker_count < 1) {
+        walk.walker_count = 1;
+    } else if (walk.walker_count > MAX_STAT_WORKERS) {
+        walk.walker_count = MAX_STAT_WORKERS;
+    }
+
+    walk.deques = (WorkDeque *)calloc(walk.walker_count, sizeof(WorkDeque));
+    char *path = strdup(target);
+    DirListing *root = (DirListing *)malloc(sizeof(DirListing));
+    if (!walk.deques || !path || !root) {
+        report_error(5);
+    }
+    init_listing(root, path);
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.changed, NULL);
+
+    push_listing(&walk, 0, root);
+    walk.pending = 1;
+
+    while (started < walk.walker_count) {
+        walkers[started] = (WalkerArg){&walk, started, (char *)malloc(DIRENT_BATCH_SIZE)};
+        if (!walkers[started].batch) {
+            break;
+        }
+        if (pthread_create(&threads[started], NULL, tree_walker, &walkers[started]) != 0) {
+            free(walkers[started].batch);
+            break;
+        }
+        started++;
+    }
+    // Without a single thread the printer reads every directory itself
+
+    int status = print_tree(&walk, root, 1);
+
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        free(walkers[i].batch);
+    }
+    for (long i = 0; i < walk.walker_count; i++) {
+        free(walk.deques[i].items);
+    }
+    free(walk.deques);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.changed);
+    return status;
 }
 
-int entry_sorter(const void *a, const void *b) {
-    const struct dirent *first = *(const struct dirent **)a;
-    const struct dirent *second = *(const struct dirent **)b;
+int entry_sorter(const void *a, const void *b, void *names) {
+    const char *first = (const char *)names + ((const EntryRecord *)a)->name_offset;
+    const char *second = (const char *)names + ((const EntryRecord *)b)->name_offset;
 
-    if (first->d_name[0] == '.' && second->d_name[0] != '.') return -1;
-    if (first->d_name[0] != '.' && second->d_name[0] == '.') return 1;
+    if (first[0] == '.' && second[0] != '.') return -1;
+    if (first[0] != '.' && second[0] == '.') return 1;
 
-    return strcasecmp(first->d_name, second->d_name);
-}
\ No newline at end of file
+    return strcasecmp(first, second);
+}